@@ -12,6 +12,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 #endif
 
 /* Keyboard control register port. */
@@ -138,4 +142,8 @@ print_stats (void)
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  frame_print_stats ();
+  swap_print_stats ();
+#endif
 }
@@ -32,7 +32,9 @@ enum
 
     /* additional system call */
     SYS_FIBONACCI,
-    SYS_MAXOFFOURINT
+    SYS_MAXOFFOURINT,
+    SYS_FORK,                   /* Duplicate this process. */
+    SYS_VMSTAT                  /* Report paging statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
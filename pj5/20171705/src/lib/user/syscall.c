@@ -210,3 +210,15 @@ max_of_four_int(int a,int b,int c, int d)
 {
   return syscall4 (SYS_MAXOFFOURINT, a, b, c, d);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+int
+vmstat (struct vmstat *st)
+{
+  return syscall1 (SYS_VMSTAT, st);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -47,5 +48,7 @@ int inumber (int fd);
 
 int fibonacci(int n);
 int max_of_four_int(int a,int b,int c,int d);
+pid_t fork (void);
+int vmstat (struct vmstat *);
 
 #endif /* lib/user/syscall.h */
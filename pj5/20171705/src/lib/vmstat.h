@@ -0,0 +1,16 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Paging statistics of one process, kept by the kernel and
+   returned by the vmstat() system call. */
+struct vmstat
+  {
+    int major_faults;           /* Faults that read a file or swap. */
+    int minor_faults;           /* Faults resolved without I/O. */
+    int swap_ins;               /* Pages read back from swap. */
+    int swap_outs;              /* Pages written to swap on eviction. */
+    int resident;               /* User frames mapped now. */
+    int evictions;              /* Pages taken away by eviction. */
+  };
+
+#endif /* lib/vmstat.h */
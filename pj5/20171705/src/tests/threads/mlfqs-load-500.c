@@ -0,0 +1,101 @@
+/* Micro-benchmark for the advanced scheduler's tick handler.
+
+   mlfqs-load-60 scaled up to 500 threads, made shorter.  Each
+   load thread sleeps for 10 seconds, spins for 20 seconds, and
+   then sleeps for another 10 seconds.  The main thread counts how
+   many times it can go round an empty loop per timer tick: once
+   before the load threads exist, once while they all sleep, and
+   once while they are all ready.  Time spent in the timer
+   interrupt is time taken from that loop, so the drop from the
+   first count shows what the tick handler costs with that many
+   threads.
+
+   This is not one of the graded tests, so it is not in
+   tests/threads_TESTS.  Run it with enough memory for 500 thread
+   stacks, e.g. "pintos -m 8 -- -q -mlfqs run mlfqs-load-500". */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static int64_t start_time;
+
+static void load_thread (void *aux);
+static int64_t spins_per_tick (void);
+
+#define THREAD_CNT 500
+
+/* Number of ticks each measurement lasts. */
+#define MEASURE_TICKS TIMER_FREQ
+
+void
+test_mlfqs_load_500 (void)
+{
+  int64_t idle_spins;
+  int started;
+  int load_avg;
+
+  ASSERT (thread_mlfqs);
+
+  idle_spins = spins_per_tick ();
+  msg ("No load threads: %lld loops per tick.", idle_spins);
+
+  start_time = timer_ticks ();
+  for (started = 0; started < THREAD_CNT; started++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "load %d", started);
+      if (thread_create (name, PRI_DEFAULT, load_thread, NULL) == TID_ERROR)
+        break;
+    }
+  msg ("Started %d load threads.", started);
+
+  msg ("%d sleeping threads: %lld loops per tick.",
+       started, spins_per_tick ());
+
+  timer_sleep (start_time + 12 * TIMER_FREQ - timer_ticks ());
+  msg ("%d ready threads: %lld loops per tick.",
+       started, spins_per_tick ());
+  load_avg = thread_get_load_avg ();
+  msg ("Load average=%d.%02d.", load_avg / 100, load_avg % 100);
+
+  /* Let the load threads exit. */
+  timer_sleep (start_time + 41 * TIMER_FREQ - timer_ticks ());
+}
+
+/* Counts iterations of an empty loop over MEASURE_TICKS ticks,
+   starting at a tick boundary, and returns the count per tick. */
+static int64_t
+spins_per_tick (void)
+{
+  int64_t start, spins = 0;
+
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+
+  start = timer_ticks ();
+  while (timer_elapsed (start) < MEASURE_TICKS)
+    {
+      spins++;
+      barrier ();
+    }
+  return spins / MEASURE_TICKS;
+}
+
+static void
+load_thread (void *aux UNUSED)
+{
+  int64_t sleep_time = 10 * TIMER_FREQ;
+  int64_t spin_time = sleep_time + 20 * TIMER_FREQ;
+  int64_t exit_time = spin_time + 10 * TIMER_FREQ;
+
+  thread_set_nice (20);
+  timer_sleep (sleep_time - timer_elapsed (start_time));
+  while (timer_elapsed (start_time) < spin_time)
+    continue;
+  timer_sleep (exit_time - timer_elapsed (start_time));
+}
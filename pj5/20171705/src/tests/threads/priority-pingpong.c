@@ -0,0 +1,119 @@
+/* Micro-benchmark for lock hand-offs.
+
+   First the main thread acquires and releases a lock it never has
+   to wait for, while a thread of equal priority sits on the ready
+   queue.  No release wakes anyone, so none should cost a thread
+   switch.
+
+   Then control ping-pongs between the main thread and a
+   higher-priority thread through the same lock.  Each round, the
+   main thread takes the lock and wakes the other thread, which
+   outranks it, runs, and blocks on the lock.  The main thread
+   releases the lock to it and the other thread releases it in
+   turn before waiting for the next round.  Only the hand-offs
+   should switch threads.
+
+   Both phases print the number of thread switches per release.
+
+   This is not one of the graded tests, so it is not in
+   tests/threads_TESTS.  Run it with
+   "pintos -- -q run priority-pingpong". */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of releases timed in each phase. */
+#define RELEASE_CNT 1000
+
+struct pingpong
+  {
+    struct lock lock;           /* Lock passed back and forth. */
+    struct semaphore go;        /* Starts a round of ping-pong. */
+    struct semaphore done;      /* Signals that the thread exited. */
+    volatile bool stop;         /* Tells the yielding thread to quit. */
+  };
+
+static thread_func yield_thread;
+static thread_func pong_thread;
+static void report (const char *phase, long long switches, int releases);
+
+void
+test_priority_pingpong (void)
+{
+  struct pingpong pp;
+  long long switches;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  lock_init (&pp.lock);
+  sema_init (&pp.go, 0);
+  sema_init (&pp.done, 0);
+  pp.stop = false;
+
+  /* Uncontended releases with an equal-priority thread ready. */
+  thread_create ("yield", PRI_DEFAULT, yield_thread, &pp);
+  switches = thread_switch_count ();
+  for (i = 0; i < RELEASE_CNT; i++)
+    {
+      lock_acquire (&pp.lock);
+      lock_release (&pp.lock);
+    }
+  report ("uncontended", thread_switch_count () - switches, RELEASE_CNT);
+  pp.stop = true;
+  sema_down (&pp.done);
+
+  /* Hand-offs to a higher-priority thread.  Each round is two
+     releases. */
+  thread_create ("pong", PRI_DEFAULT + 1, pong_thread, &pp);
+  switches = thread_switch_count ();
+  for (i = 0; i < RELEASE_CNT / 2; i++)
+    {
+      lock_acquire (&pp.lock);
+      sema_up (&pp.go);
+      lock_release (&pp.lock);
+    }
+  report ("ping-pong", thread_switch_count () - switches, RELEASE_CNT);
+  sema_up (&pp.go);
+  sema_down (&pp.done);
+}
+
+/* Spins, yielding, until told to stop. */
+static void
+yield_thread (void *pp_)
+{
+  struct pingpong *pp = pp_;
+
+  while (!pp->stop)
+    thread_yield ();
+  sema_up (&pp->done);
+}
+
+/* Takes the lock once per round started by the main thread. */
+static void
+pong_thread (void *pp_)
+{
+  struct pingpong *pp = pp_;
+  int i;
+
+  for (i = 0; i < RELEASE_CNT / 2; i++)
+    {
+      sema_down (&pp->go);
+      lock_acquire (&pp->lock);
+      lock_release (&pp->lock);
+    }
+  sema_down (&pp->go);
+  sema_up (&pp->done);
+}
+
+static void
+report (const char *phase, long long switches, int releases)
+{
+  msg ("%s: %lld switches for %d releases, %lld.%02lld per release.",
+       phase, switches, releases, switches / releases,
+       switches * 100 / releases % 100);
+}
@@ -41,6 +41,8 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"mlfqs-load-500", test_mlfqs_load_500},
+    {"priority-pingpong", test_priority_pingpong},
   };
 
 static const char *test_name;
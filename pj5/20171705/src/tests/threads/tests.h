@@ -35,6 +35,8 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_mlfqs_load_500;
+extern test_func test_priority_pingpong;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,33 @@
+/* Micro-benchmark for fault-around.
+
+   Reads one byte from each page of a 1 MB array that is stored in
+   the executable, so that every page of it faults in from the
+   file.  Without fault-around that is one page fault per page;
+   with it, one per window of pages.
+
+   This is not one of the graded tests, so it is not in
+   tests/vm_TESTS.  Run it with and without fault-around, e.g.
+   "pintos ... -- -q -fa=1 run fault-around" and
+   "pintos ... -- -q run fault-around", and compare the page fault
+   counts that the kernel prints when it shuts down. */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+
+/* Initialized, so all of it is in the executable. */
+static const char data[SIZE] = { 1 };
+
+void
+test_main (void)
+{
+  size_t i;
+  int sum = 0;
+
+  for (i = 0; i < SIZE; i += 4096)
+    sum += ((volatile const char *) data)[i];
+  if (sum != 1)
+    fail ("sum is %d, not 1", sum);
+  msg ("read %d pages", SIZE / 4096);
+}
@@ -0,0 +1,38 @@
+/* Forks a child that checks it sees the parent's data and then
+   overwrites all of it, and verifies that the parent's copy is
+   unchanged, that is, that the pages shared by fork() were copied
+   on write. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  memset (buf, 'p', sizeof buf);
+  child = fork ();
+  if (child == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != 'p')
+          exit (1);
+      memset (buf, 'c', sizeof buf);
+      exit (0);
+    }
+  if (child == PID_ERROR)
+    fail ("fork failed");
+
+  CHECK (wait (child) == 0, "wait for child");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 'p')
+      fail ("byte %zu changed to '%c' by child", i, buf[i]);
+}
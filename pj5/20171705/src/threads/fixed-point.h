@@ -0,0 +1,29 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic for the advanced scheduler.
+
+   A fixed-point value X represents the real number X / FP_ONE.
+   Names ending in _INT take an integer as their second operand;
+   the others take two fixed-point values.  Conversions back to
+   integers truncate toward zero. */
+
+#define FP_SHIFT 14
+#define FP_ONE (1 << FP_SHIFT)
+
+#define FP_FROM_INT(N) ((N) * FP_ONE)
+#define FP_TO_INT(X) ((X) / FP_ONE)
+
+#define FP_ADD(X, Y) ((X) + (Y))
+#define FP_SUB(X, Y) ((X) - (Y))
+#define FP_MUL(X, Y) ((int) ((int64_t) (X) * (Y) / FP_ONE))
+#define FP_DIV(X, Y) ((int) ((int64_t) (X) * FP_ONE / (Y)))
+
+#define FP_ADD_INT(X, N) ((X) + (N) * FP_ONE)
+#define FP_SUB_INT(X, N) ((X) - (N) * FP_ONE)
+#define FP_MUL_INT(X, N) ((X) * (N))
+#define FP_DIV_INT(X, N) ((X) / (N))
+
+#endif /* threads/fixed-point.h */
@@ -37,6 +37,10 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -99,7 +103,7 @@ main (void)
   malloc_init ();
   paging_init ();
 #ifdef VM
-  init_frame_list();
+  init_frame_table();
 #endif
   /* Segmentation. */
 #ifdef USERPROG
@@ -255,6 +259,10 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-fa"))
+        fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-vmstat"))
+        vmstat_on_exit = true;
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
@@ -385,6 +393,8 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -fa=PAGES          Map up to PAGES file pages per page fault.\n"
+          "  -vmstat            Print each process's paging statistics at exit.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
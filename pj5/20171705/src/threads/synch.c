@@ -32,6 +32,15 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Longest chain of lock holders a priority donation is passed
+   along, as in H waits on a lock held by M, which waits on a lock
+   held by L, and so on. */
+#define DONATION_DEPTH 8
+
+static bool donation_enabled (void);
+static void donate_priority (struct thread *);
+static void take_donors (struct lock *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -68,7 +77,7 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_insert_ordered(&sema->waiters,&thread_current()->elem,list_compare_priority,NULL);
+      list_push_back (&sema->waiters, &thread_current ()->elem);
       thread_block ();
     }
   sema->value--;
@@ -102,29 +111,41 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, yielding to it if it outranks the running thread.
 
    This function may be called from an interrupt handler. */
 void
 sema_up (struct semaphore *sema) 
 {
   enum intr_level old_level;
+  struct thread *t = NULL;
 
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)){ 
-
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
-	  
-  }
+  if (!list_empty (&sema->waiters))
+    {
+      /* list_compare_priority() orders by decreasing priority, so
+         the "minimum" is the earliest of the highest-priority
+         waiters.  Waiters' priorities may have changed by donation
+         since they blocked, so this is done now, not on insert. */
+      t = list_entry (list_min (&sema->waiters, list_compare_priority, NULL),
+                      struct thread, elem);
+      list_remove (&t->elem);
+      thread_unblock (t);
+    }
   sema->value++;
-  intr_set_level (old_level);
+
   /*proj3*/
-#ifndef USERPROG
-  thread_yield();
-#endif
+  if (t != NULL && t->priority > thread_current ()->priority)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+  intr_set_level (old_level);
 }
 
 static void sema_test_helper (void *sema_);
@@ -199,12 +220,35 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  old_level = intr_disable ();
+  /* sema_down(), with donation each time round: a thread woken by
+     lock_release() may find the lock taken again, by
+     lock_try_acquire() or a thread that ran first, and must then
+     donate to the new holder. */
+  while (lock->semaphore.value == 0)
+    {
+      if (donation_enabled ())
+        {
+          cur->wait_lock = lock;
+          list_push_back (&lock->holder->donors, &cur->donor_elem);
+          donate_priority (cur);
+        }
+      list_push_back (&lock->semaphore.waiters, &cur->elem);
+      thread_block ();
+    }
+  lock->semaphore.value--;
+  cur->wait_lock = NULL;
+  lock->holder = cur;
+  if (donation_enabled ())
+    take_donors (lock);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -216,14 +260,21 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      if (donation_enabled ())
+        take_donors (lock);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -235,11 +286,84 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  struct list_elem *e;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  if (donation_enabled ())
+    {
+      /* Threads waiting for LOCK stop donating to us; they will
+         donate to whichever of them gets it next. */
+      for (e = list_begin (&cur->donors); e != list_end (&cur->donors); )
+        {
+          struct thread *donor = list_entry (e, struct thread, donor_elem);
+          if (donor->wait_lock == lock)
+            e = list_remove (e);
+          else
+            e = list_next (e);
+        }
+      thread_refresh_priority (cur);
+    }
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+}
+
+/* Returns true if locks donate priority.  The advanced scheduler
+   and priority aging both set priorities from recent_cpu and nice,
+   overwriting any donation, so donation is off under either. */
+static bool
+donation_enabled (void)
+{
+#ifndef USERPROG
+  if (thread_prior_aging)
+    return false;
+#endif
+  return !thread_mlfqs;
+}
+
+/* Passes T's priority on to the holder of the lock T waits for,
+   and from there along the chain of holders each waiting for
+   another lock, stopping at a holder that already has at least
+   that priority or after DONATION_DEPTH steps. */
+static void
+donate_priority (struct thread *t)
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH && t->wait_lock != NULL; depth++)
+    {
+      struct thread *holder = t->wait_lock->holder;
+
+      if (holder == NULL || holder->priority >= t->priority)
+        break;
+      thread_refresh_priority (holder);
+      t = holder;
+    }
+}
+
+/* Makes the threads still waiting for LOCK donors to its new
+   holder. */
+static void
+take_donors (struct lock *lock)
+{
+  struct list *waiters = &lock->semaphore.waiters;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (waiters); e != list_end (waiters); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      list_push_back (&lock->holder->donors, &t->donor_elem);
+    }
+  thread_refresh_priority (lock->holder);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/fixed-point.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -24,15 +25,41 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running: one FIFO queue per
+   priority, and a mask with bit P set while ready_queues[P] is
+   not empty, so the highest ready priority is found in a couple
+   of instructions however many threads are ready. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;                   /* # of threads in all queues. */
 
 //proj3
-static struct list blocked_list;
+/* Threads sleeping in timer_sleep(), hashed by wake-up tick into
+   SLEEP_WHEEL_SIZE buckets.  Each bucket is kept sorted by wake-up
+   tick, so every thread due at tick T is at the front of bucket
+   T % SLEEP_WHEEL_SIZE.  NEXT_WAKEUP is the earliest wake-up tick
+   of any sleeper, or INT64_MAX if there are none; the timer
+   interrupt does nothing more than compare against it until that
+   tick arrives. */
+#define SLEEP_WHEEL_SIZE 64
+static struct list sleep_wheel[SLEEP_WHEEL_SIZE];
+static int64_t next_wakeup;
 
 static int load_avg;
 
+/* recent_cpu decays once a second by a factor that depends on
+   the load average at that moment.  Rather than decaying every
+   thread then, the factor is recorded for decay epoch
+   DECAY_EPOCH, and a thread catches up on the epochs it missed
+   when it next becomes ready (see recent_cpu_sync()).  Only the
+   last DECAY_HISTORY factors are kept, so once every
+   DECAY_HISTORY epochs the threads still blocked catch up too,
+   before the oldest factor they need is overwritten. */
+#define DECAY_HISTORY 64
+static int decay_coef[DECAY_HISTORY];
+static unsigned decay_epoch;
+
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
@@ -58,6 +85,7 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long switch_cnt;    /* # of switches between threads. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -79,6 +107,12 @@ static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_top_priority (void);
+static int mlfqs_priority (const struct thread *);
+static void recent_cpu_sync (struct thread *);
+static void mlfqs_refresh (struct thread *);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
@@ -101,12 +135,18 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
   list_init (&all_list);
-  list_init (&blocked_list);
+  for (i = 0; i < SLEEP_WHEEL_SIZE; i++)
+    list_init (&sleep_wheel[i]);
+  next_wakeup = INT64_MAX;
   //init_frame_list();
   load_avg = 0;
 
@@ -184,6 +224,16 @@ thread_print_stats (void)
           idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Returns the number of switches between threads so far. */
+long long
+thread_switch_count (void)
+{
+  enum intr_level old_level = intr_disable ();
+  long long cnt = switch_cnt;
+  intr_set_level (old_level);
+  return cnt;
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -278,9 +328,11 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  /*proj3*/
-  list_insert_ordered(&ready_list,&t->elem,list_compare_priority,NULL);
-  //list_push_back(&ready_list,&t->elem);
+#ifndef USERPROG
+  if (thread_prior_aging || thread_mlfqs)
+    mlfqs_refresh (t);
+#endif
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -351,9 +403,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-	  //proj3
-  	list_insert_ordered(&ready_list,&cur->elem,list_compare_priority,NULL);
-	//list_push_back(&ready_list,&cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
 
@@ -381,14 +431,48 @@ thread_foreach (thread_action_func *func, void *aux)
 void
 thread_set_priority (int new_priority) 
 {
-  if(thread_current()->priority > new_priority)
-  {
-  	thread_current ()->priority = new_priority;
-	/*proj3*/
-	thread_yield();
-  }
+  struct thread *cur = thread_current ();
+  int old_priority = cur->priority;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_refresh_priority (cur);
+  intr_set_level (old_level);
+
+  /*proj3*/
+  if (cur->priority < old_priority)
+    thread_yield ();
+}
+
+/* Sets T's priority to the higher of its base priority and the
+   priorities of the threads donating to it, moving T to the
+   matching ready queue if it is ready.  Interrupts must be
+   off. */
+void
+thread_refresh_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->donors); e != list_end (&t->donors);
+       e = list_next (e))
+    {
+      struct thread *donor = list_entry (e, struct thread, donor_elem);
+      if (donor->priority > priority)
+        priority = donor->priority;
+    }
+
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
   else
-  	thread_current ()->priority = new_priority;
+    t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -406,14 +490,7 @@ thread_set_nice (int nice)
   int new_priority;
 
   thread_current()->nice = nice;
-  new_priority = fixed_cal_int(thread_current()->recent_cpu,4,DIV);
-  new_priority = fixed_cal_int(new_priority,nice*2,ADD);
-  new_priority = fixed_to_int(int_cal_fixed(PRI_MAX,new_priority,SUB));
- 
-  if(new_priority > PRI_MAX)
-	 new_priority = PRI_MAX;
-  else if(new_priority < PRI_MIN)
-	 new_priority = PRI_MIN; 
+  new_priority = mlfqs_priority(thread_current());
 
   thread_current()->priority = new_priority;
 
@@ -433,14 +510,14 @@ thread_get_nice (void)
 int
 thread_get_load_avg (void) 
 {  
-  return fixed_to_int(load_avg*100);
+  return FP_TO_INT(FP_MUL_INT(load_avg,100));
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  return fixed_to_int(thread_current()->recent_cpu*100);
+  return FP_TO_INT(FP_MUL_INT(thread_current()->recent_cpu,100));
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -529,6 +606,9 @@ init_thread (struct thread *t, const char *name, int priority)
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
+  t->base_priority = priority;
+  t->wait_lock = NULL;
+  list_init (&t->donors);
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable ();
@@ -546,10 +626,16 @@ init_thread (struct thread *t, const char *name, int priority)
 /*add in proj2 */
   list_init(&(t->file_list));
   t->file_bitmap = NULL;
+#ifdef VM
+  list_init(&(t->mmap_list));
+  t->next_mapid = 0;
+  memset(&t->vmstat,0,sizeof t->vmstat);
+#endif
 
 /*add in proj3 */
   t->nice = running_thread()->nice;
   t->recent_cpu = running_thread()->recent_cpu;
+  t->cpu_epoch = decay_epoch;
 
 }
 
@@ -574,10 +660,53 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int pri = ready_top_priority ();
+  struct thread *t;
+
+  if (pri < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  t = list_entry (list_front (&ready_queues[pri]), struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   -1 if no thread is ready. */
+static int
+ready_top_priority (void)
+{
+  uint32_t high = ready_mask >> 32, low = ready_mask;
+
+  if (ready_mask == 0)
+    return -1;
+
+  /* Highest set bit of READY_MASK. */
+  return high != 0 ? 63 - __builtin_clz (high) : 31 - __builtin_clz (low);
+}
+
+/* Appends T to the ready queue for its priority. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->priority >= PRI_MIN && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes T from the ready queue for its priority. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -645,7 +774,10 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      switch_cnt++;
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -681,6 +813,16 @@ thread_findname_foreach (const char* name)
     }
   return false;
 }
+static bool
+wakeup_less (const struct list_elem *a, const struct list_elem *b,
+             void *aux UNUSED)
+{
+  return list_entry (a, struct thread, block_elem)->ticks
+         < list_entry (b, struct thread, block_elem)->ticks;
+}
+
+/* Blocks the current thread until the timer reaches TICKS.
+   Returns at once if that tick has already passed. */
 void thread_block_with_time(int64_t ticks)
 {
   struct thread* cur = thread_current();
@@ -689,146 +831,168 @@ void thread_block_with_time(int64_t ticks)
   ASSERT (!intr_context ());
 
   old_level = intr_disable();
-  
-  cur->ticks = ticks;
 
-  list_insert_ordered(&blocked_list,&cur->block_elem,list_compare_priority,NULL);
+  /* A thread due now or earlier would not be seen until its
+     bucket came round again, so don't sleep at all. */
+  if(ticks <= timer_ticks()){
+	  intr_set_level(old_level);
+	  return;
+  }
+
+  cur->ticks = ticks;
+  list_insert_ordered(&sleep_wheel[ticks % SLEEP_WHEEL_SIZE],
+		  &cur->block_elem,wakeup_less,NULL);
+  if(ticks < next_wakeup)
+	  next_wakeup = ticks;
 
   thread_block();
   intr_set_level(old_level);
   
 }
+
+/* Wakes every sleeper whose wake-up tick has arrived.  Called
+   from thread_tick() on every timer interrupt, so the common case
+   of no thread being due is a single comparison. */
 void block_check()
 {
-  struct list_elem* e;
-  struct thread* th;
+  struct list *bucket;
+  int64_t now = timer_ticks();
+  int i;
 
   ASSERT (intr_get_level () == INTR_OFF);
 
-  if(list_empty(&blocked_list))
+  if(now < next_wakeup)
 	 return;
 
-  for(e = list_begin(&blocked_list); e != list_end(&blocked_list);){
-	  th = list_entry(e,struct thread,block_elem);
-	  if( th->ticks <= timer_ticks()){
-		  thread_unblock(th);
-		  e = list_remove(e);
-	  }
-	  else 
-		  e = list_next(e);
+  bucket = &sleep_wheel[now % SLEEP_WHEEL_SIZE];
+  while(!list_empty(bucket)){
+	  struct thread *th = list_entry(list_front(bucket),struct thread,block_elem);
+	  if(th->ticks > now)
+		  break;
+	  list_pop_front(bucket);
+	  thread_unblock(th);
   }
+
+  /* The earliest remaining sleeper is at the front of some bucket. */
+  next_wakeup = INT64_MAX;
+  for(i = 0; i < SLEEP_WHEEL_SIZE; i++)
+	  if(!list_empty(&sleep_wheel[i])){
+		  struct thread *th = list_entry(list_front(&sleep_wheel[i]),struct thread,block_elem);
+		  if(th->ticks < next_wakeup)
+			  next_wakeup = th->ticks;
+	  }
 }
 void thread_aging()
 {
-  thread_current()->recent_cpu = fixed_cal_int(thread_current()->recent_cpu,1,ADD);
+  thread_current()->recent_cpu = FP_ADD_INT(thread_current()->recent_cpu,1);
 }
 
-bool list_compare_priority(struct list_elem* a,struct list_elem* b,void *aux)
+bool list_compare_priority(const struct list_elem* a,const struct list_elem* b,void *aux)
 {
-  struct thread* temp1 = list_entry(a,struct thread, elem);
-  struct thread* temp2 = list_entry(b,struct thread, elem);
+  const struct thread* temp1 = list_entry(a,struct thread, elem);
+  const struct thread* temp2 = list_entry(b,struct thread, elem);
 
   if(temp1->priority > temp2->priority)
 	  return true;
   else
 	  return false;
 }
-int int_to_fixed(int num)
-{
-	return num*(1<<14);
-}
-int fixed_to_int(int fixed)
-{
-	return fixed/(1<<14);
-}
-int fixed_cal_int(int fixed,int num,enum cal op)
-{
-	switch(op){
-		case ADD : return fixed + num*(1<<14);
-			   break;
-		case SUB : return fixed - num*(1<<14);
-			   break;
-		case MUL : return fixed*num;
-			   break;
-		case DIV : return fixed/num;
-			   break;
-		default : return 0;
-	}
-}
-int int_cal_fixed(int num,int fixed,enum cal op)
-{
-	switch(op){
-		case SUB : return num*(1<<14) - fixed;
-			   break;
-		default : return 0;
-	}
-}
-int fixed_cal_fixed(int fixed1,int fixed2,enum cal op)
-{
-	switch(op){
-		case ADD : return fixed1 + fixed2;
-			   break;
-		case SUB : return fixed1 - fixed2;
-			   break;
-		case MUL : return ((int64_t)fixed1)*fixed2/(1<<14);
-			   break;
-		case DIV : return ((int64_t)fixed1)*(1<<14)/fixed2;
-			   break;
-		default : return 0;
-	}
-}
 void calculate_load_avg()
 {
-  int retval,term1,term2;
-  int ready_length = list_size(&ready_list);
+  int ready_length = ready_cnt;
 
   if(thread_current() != idle_thread)
 	  ready_length++;
 
-  load_avg = fixed_cal_int(fixed_cal_int(fixed_cal_int(load_avg,59,MUL),ready_length,ADD),60,DIV);
+  load_avg = FP_DIV_INT(FP_ADD_INT(FP_MUL_INT(load_avg,59),ready_length),60);
 }
 
+/* Starts a new decay epoch.  The running thread and every ready
+   thread are brought up to date at once, since their priorities
+   order the ready queues; blocked threads wait until they are
+   unblocked, or until the history is about to wrap. */
 void calculate_recent_cpu()
 {
-  struct thread *th;
   struct list_elem *e;
-  int term1;
-  
-  for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)){
-	  th = list_entry(e,struct thread,allelem);
-  	  term1 = fixed_cal_fixed(2*load_avg,fixed_cal_int(2*load_avg,1,ADD),DIV);
-	  term1 = fixed_cal_fixed(term1,th->recent_cpu,MUL);
-	
-	  th->recent_cpu = fixed_cal_int(term1,th->nice,ADD);
-  }
+  int pri;
+
+  decay_coef[decay_epoch % DECAY_HISTORY] =
+	  FP_DIV(2*load_avg,FP_ADD_INT(2*load_avg,1));
+  decay_epoch++;
+
+  mlfqs_refresh(thread_current());
+  for(pri = PRI_MIN; pri <= PRI_MAX; pri++)
+	  for(e = list_begin(&ready_queues[pri]); e != list_end(&ready_queues[pri]);){
+		  struct thread *th = list_entry(e,struct thread,elem);
+
+		  /* TH may move to another queue. */
+		  e = list_next(e);
+		  mlfqs_refresh(th);
+	  }
+
+  if(decay_epoch % DECAY_HISTORY == 0)
+	  for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e))
+		  recent_cpu_sync(list_entry(e,struct thread,allelem));
 }
 
+/* Between decays only the running thread's recent_cpu changes,
+   so only its priority needs recomputing. */
 void calculate_priority()
 {
-  struct thread *th;
-  struct list_elem *e;
-  int term1;
-  int new_priority;
-  int old_priority = thread_current()->priority;
+  struct thread *cur = thread_current();
+
+  if(cur == idle_thread)
+	  return;
+
+  cur->priority = mlfqs_priority(cur);
+  if(cur->priority < ready_top_priority())
+	  intr_yield_on_return();
+}
 
-  for(e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)){
-	  th = list_entry(e,struct thread,allelem);
-	  
-  	  term1 = fixed_cal_int(th->recent_cpu,4,DIV);
-  	  term1 = fixed_cal_int(term1,th->nice*2,ADD);
+/* Returns T's priority as given by its recent_cpu and nice. */
+static int mlfqs_priority(const struct thread *t)
+{
+  int priority = FP_TO_INT(FP_SUB(FP_FROM_INT(PRI_MAX),
+			  FP_ADD_INT(FP_DIV_INT(t->recent_cpu,4),t->nice*2)));
 
-	  new_priority = fixed_to_int(int_cal_fixed(PRI_MAX,term1,SUB));
-	  if(new_priority > PRI_MAX)
-		  new_priority = PRI_MAX;
-	  else if(new_priority < PRI_MIN)
-		  new_priority = PRI_MIN;
+  if(priority > PRI_MAX)
+	  return PRI_MAX;
+  else if(priority < PRI_MIN)
+	  return PRI_MIN;
+  return priority;
+}
 
-	  th->priority = new_priority;
-  }
-  list_sort(&ready_list,list_compare_priority,NULL);
+/* Applies to T's recent_cpu the decays of the epochs that have
+   begun since T was last brought up to date.  That is never more
+   than DECAY_HISTORY epochs, thanks to the catch-up in
+   calculate_recent_cpu(). */
+static void recent_cpu_sync(struct thread *t)
+{
+  unsigned missed = decay_epoch - t->cpu_epoch;
+  unsigned epoch;
 
-  if(old_priority > thread_current()->priority)
-	  intr_yield_on_return();
+  ASSERT(missed <= DECAY_HISTORY);
+  for(epoch = decay_epoch - missed; epoch != decay_epoch; epoch++)
+	  t->recent_cpu = FP_ADD_INT(FP_MUL(decay_coef[epoch % DECAY_HISTORY],
+				  t->recent_cpu),t->nice);
+  t->cpu_epoch = decay_epoch;
+}
+
+/* Brings T's recent_cpu and priority up to date, moving T to the
+   matching ready queue if it is ready. */
+static void mlfqs_refresh(struct thread *t)
+{
+  int new_priority;
+
+  recent_cpu_sync(t);
+  new_priority = mlfqs_priority(t);
+  if(t->status == THREAD_READY && t->priority != new_priority){
+	  ready_remove(t);
+	  t->priority = new_priority;
+	  ready_push(t);
+  }
+  else
+	  t->priority = new_priority;
 }
 void destroy_file_bitmap()
 {
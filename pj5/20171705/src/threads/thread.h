@@ -7,18 +7,13 @@
 #include <hash.h>
 #include "synch.h"
 #include <stdint.h>
+#include <vmstat.h>
 #include "vm/page.h"
 
 #ifndef USERPROG
 /* project 3 */
 extern bool thread_prior_aging;
 #endif
-enum cal{
-	ADD,
-	SUB,
-	MUL,
-	DIV
-};
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -102,11 +97,15 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority before donation. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct lock *wait_lock;             /* Lock being waited for, or NULL. */
+    struct list donors;                 /* Threads waiting on our locks. */
+    struct list_elem donor_elem;        /* Element in a holder's donors. */
 
 #ifdef USERPROG    
     /* Owned by userprog/process.c. */
@@ -127,12 +126,16 @@ struct thread
     struct bitmap* file_bitmap;
 
     struct list_elem block_elem;
-    uint64_t ticks;
+    int64_t ticks;
     int nice;
     int64_t recent_cpu;
+    unsigned cpu_epoch;                 /* Decay epoch of recent_cpu. */
 #ifdef VM
     /*proj4*/
     struct hash spt;
+    struct list mmap_list;              /* mmap()ed files. */
+    int next_mapid;                     /* Id for the next mmap(). */
+    struct vmstat vmstat;               /* Paging statistics. */
 #endif
 
     /*proj5*/
@@ -151,6 +154,7 @@ void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+long long thread_switch_count (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -171,6 +175,7 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_refresh_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -181,14 +186,7 @@ bool thread_findname_foreach (const char* name);
 void thread_block_with_time(int64_t ticks);
 void block_check(void);
 void thread_aging(void);
-bool list_compare_priority(struct list_elem* a,struct list_elem* b,void *aux);
-
-//fixed-point
-int int_to_fixed(int num);
-int fixed_to_int(int fixed);
-int fixed_cal_int(int fixed,int num,enum cal op);
-int int_cal_fixed(int num,int fixed,enum cal op);
-int fixed_cal_fixed(int fixed1,int fixed2,enum cal op);
+bool list_compare_priority(const struct list_elem* a,const struct list_elem* b,void *aux);
 
 void calculate_load_avg();
 void calculate_recent_cpu();
@@ -1,6 +1,7 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -10,10 +11,33 @@
 #include "threads/palloc.h"
 #include "devices/block.h"
 #include "vm/frame.h"
+#include "filesys/file.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+#ifdef VM
+/* Size, in pages, of the aligned window around a faulting page of
+   a file whose other pages are mapped along with it.  Set with
+   -fa; 1 maps only the faulting page. */
+int fault_around_pages = 8;
+
+/* Number of pages mapped ahead of use by fault-around. */
+static long long fault_around_cnt;
+
+/* A page of zeros, mapped read-only wherever a page that starts
+   out zeroed has only been read, and the number of such faults. */
+static uint8_t *zero_page;
+static long long zero_map_cnt;
+
+static bool load_file_page (struct spt_e *, uint8_t *kpage);
+static void fault_around (struct spt_e *);
+static bool is_zero_fill (const struct spt_e *);
+static bool zero_fault (struct spt_e *, bool write);
+#endif
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
@@ -65,6 +89,10 @@ exception_init (void)
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
 
+#ifdef VM
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+#endif
+
 }
 
 /* Prints exception statistics. */
@@ -72,6 +100,10 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  printf ("Exception: %lld pages mapped by fault-around\n", fault_around_cnt);
+  printf ("Exception: %lld pages mapped to the zero page\n", zero_map_cnt);
+#endif
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -158,12 +190,28 @@ page_fault (struct intr_frame *f)
 	  exit(-1);
   }
 
-  if(!not_present){
-	  exit(-1);
-  }
   struct spt_e find_element;
   find_element.vaddr = pg_round_down(fault_addr);
   struct hash_elem *e = hash_find(&thread_current()->spt,&find_element.elem);
+  struct vmstat *st = &thread_current()->vmstat;
+
+  if(!not_present){
+	  /* Only a write to a page shared by fork() or to the zero
+	     page is allowed. */
+	  struct spt_e *shared = e != NULL ? hash_entry(e,struct spt_e,elem) : NULL;
+	  if(!write || shared == NULL)
+		  exit(-1);
+	  if(shared->zero && shared->writable){
+		  if(!zero_fault(shared,true))
+			  exit(-1);
+		  st->minor_faults++;
+		  return;
+	  }
+	  if(!shared->cow || !frame_break_cow(shared))
+		  exit(-1);
+	  st->minor_faults++;
+	  return;
+  }
   if(e == NULL){
 	  bool on_stack_frame,is_stack_addr;
 	  on_stack_frame  = (f->esp <= fault_addr || fault_addr == f->esp - 32);
@@ -171,52 +219,71 @@ page_fault (struct intr_frame *f)
 	  if(!on_stack_frame || !is_stack_addr){
 		  exit(-1);
 	  }
+	  else if(!write){
+		 struct spt_e *spte = add_spte(pg_round_down(fault_addr),NULL,0,0,true,NULL,0);
+		 if(spte == NULL || !zero_fault(spte,false))
+			exit(-1);
+		 st->minor_faults++;
+		 return;
+	  }
 	  else{
 		 uint8_t *vaddr = pg_round_down(fault_addr);
 		 uint8_t *page = frame_allocate(vaddr,PAL_ZERO);
-		 struct thread *t = thread_current();
-		 memset(page,0,PGSIZE);
+		 if(page == NULL)
+			exit(-1);
 		 if(!call_install_page(vaddr,page,true)){ //writable need to edited
 			frame_free(page);
 			printf("install page error\n");
 			exit(-1);
 		 }
+		 frame_unpin(page);
+		 st->minor_faults++;
 		 return;
 	  }
 	}
+  struct spt_e* found = hash_entry(e,struct spt_e,elem);
+  if(is_zero_fill(found)){
+	  if(!zero_fault(found,write))
+		  exit(-1);
+	  st->minor_faults++;
+	  return;
+  }
+  if(frame_share_text(found)){
+	  st->minor_faults++;
+	  fault_around(found);
+	  return;
+  }
   uint8_t *vaddr = pg_round_down(fault_addr);
   uint8_t *kpage = frame_allocate(vaddr,PAL_USER);
   if(kpage == NULL){
 	printf("can't use swap partition\n");
 	exit(-1);
   }
-  struct spt_e* found = hash_entry(e,struct spt_e,elem);
   found->kpage = kpage;
   //swap in needed to be added.
   if(found->swap_slot != -1){
 	swap_to_addr(found->swap_slot,kpage);
 	found->swap_slot = -1;
+	found->cow = false;
 	if(!call_install_page(found->vaddr,kpage,found->writable)){
 		frame_free(kpage);
 		printf("install page error\n");
 		exit(-1);
 	}
+	frame_unpin(kpage);
+	st->major_faults++;
+	st->swap_ins++;
 	return;
   }	  
 
-  file_seek(found->file,found->ofs);
-  if(file_read(found->file,kpage,found->page_read_bytes) != (int) found->page_read_bytes){
+  if(!load_file_page(found,kpage)){
 	  frame_free(kpage);
 	  printf("file read error \n");
 	  exit(-1);
   }
-  memset(kpage + found->page_read_bytes,0,found->page_zero_bytes);
-
-  if(!call_install_page(found->vaddr,kpage,found->writable)){
-	  frame_free(kpage);	
-	  printf("install page error\n");
-	  exit(-1);
-  }
+  frame_unpin(kpage);
+  st->major_faults++;
+  fault_around(found);
   return;
 #else
 	if(!user){
@@ -239,3 +306,124 @@ page_fault (struct intr_frame *f)
   kill (f);
 }
 
+#ifdef VM
+/* Reads SPTE's page from its file into KPAGE and maps it, then
+   offers it to other processes running the same executable.
+   Returns false if the file is short or the page cannot be
+   mapped. */
+static bool
+load_file_page (struct spt_e *spte, uint8_t *kpage)
+{
+  if (file_read_at (spte->file, kpage, spte->page_read_bytes, spte->ofs)
+      != (int) spte->page_read_bytes)
+    return false;
+  memset (kpage + spte->page_read_bytes, 0, spte->page_zero_bytes);
+  spte->cow = false;
+  if (!call_install_page (spte->vaddr, kpage, spte->writable))
+    return false;
+  frame_register_text (spte);
+  return true;
+}
+
+/* Maps the pages in FAULT's window that are still in the same file
+   and not yet loaded, so that a program walking through its text
+   or data takes one fault per window instead of one per page.
+   A page another process holds in a shared text frame is just
+   mapped.  Others are read into free frames, but only while the
+   user pool is above its low-water mark (see frame_try_allocate()):
+   nothing is evicted for a page that may never be touched, and
+   since these pages start out not accessed, the clock reclaims
+   them first if they are not. */
+static void
+fault_around (struct spt_e *fault)
+{
+  struct thread *t = thread_current ();
+  size_t window = fault_around_pages > 1 ? fault_around_pages : 1;
+  uint8_t *start = (uint8_t *) fault->vaddr
+                   - pg_no (fault->vaddr) % window * PGSIZE;
+  size_t i;
+
+  for (i = 0; i < window; i++)
+    {
+      struct spt_e find_e, *spte;
+      struct hash_elem *e;
+      uint8_t *kpage;
+
+      find_e.vaddr = start + i * PGSIZE;
+      e = hash_find (&t->spt, &find_e.elem);
+      if (e == NULL)
+        continue;
+      spte = hash_entry (e, struct spt_e, elem);
+      if (spte->kpage != NULL || spte->swap_slot != -1 || spte->zero
+          || is_zero_fill (spte) || spte->file != fault->file)
+        continue;
+
+      if (frame_share_text (spte))
+        {
+          fault_around_cnt++;
+          continue;
+        }
+      kpage = frame_try_allocate (spte);
+      if (kpage == NULL)
+        break;
+      spte->kpage = kpage;
+      if (!load_file_page (spte, kpage))
+        {
+          spte->kpage = NULL;
+          frame_free (kpage);
+          break;
+        }
+      frame_unpin (kpage);
+      fault_around_cnt++;
+    }
+}
+
+/* Returns true if SPTE, which is not in memory, is to be filled
+   with zeros: a page of the stack, or of a segment past the end
+   of its file's data, that has never been written out. */
+static bool
+is_zero_fill (const struct spt_e *spte)
+{
+  return spte->kpage == NULL && spte->swap_slot == -1
+         && (spte->type == PAGE_ANON
+             || (spte->type == PAGE_FILE && spte->page_read_bytes == 0));
+}
+
+/* Handles a fault on SPTE, a page that reads as zeros until it is
+   written.  A read maps the shared zero page read-only, so pages
+   that are only ever read cost no frame; a write, including a
+   later one to the zero page, gets a zeroed frame of its own. */
+static bool
+zero_fault (struct spt_e *spte, bool write)
+{
+  uint8_t *kpage;
+
+  if (!write)
+    {
+      if (!call_install_page (spte->vaddr, zero_page, false))
+        return false;
+      spte->zero = true;
+      zero_map_cnt++;
+      return true;
+    }
+
+  kpage = frame_allocate (spte->vaddr, PAL_ZERO);
+  if (kpage == NULL)
+    return false;
+  if (spte->zero)
+    {
+      pagedir_clear_page (thread_current ()->pagedir, spte->vaddr);
+      spte->zero = false;
+    }
+  spte->kpage = kpage;
+  if (!call_install_page (spte->vaddr, kpage, spte->writable))
+    {
+      spte->kpage = NULL;
+      frame_free (kpage);
+      return false;
+    }
+  frame_unpin (kpage);
+  return true;
+}
+#endif
+
@@ -6,6 +6,10 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
+#ifdef VM
+extern int fault_around_pages;
+#endif
+
 void exception_init (void);
 void exception_print_stats (void);
 
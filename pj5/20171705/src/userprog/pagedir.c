@@ -7,7 +7,7 @@
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -152,7 +152,23 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
+    }
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_page (pd, vpage);
     }
 }
 
@@ -180,7 +196,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,11 +225,63 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Initializes BATCH to collect TLB invalidations for the page
+   directory that is active now. */
+void
+pagedir_batch_init (struct pagedir_batch *batch)
+{
+  batch->pd = active_pd ();
+  batch->cnt = 0;
+}
+
+/* Clears the accessed bit in the PTE for virtual page VPAGE in PD,
+   like pagedir_set_accessed (PD, VPAGE, false), but leaves any
+   stale TLB entry for it until pagedir_batch_flush (BATCH). */
+void
+pagedir_clear_accessed (uint32_t *pd, const void *vpage,
+                        struct pagedir_batch *batch)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL && (*pte & PTE_A) != 0)
+    {
+      *pte &= ~(uint32_t) PTE_A;
+      if (pd == batch->pd && batch->cnt <= PAGEDIR_BATCH_SIZE)
+        {
+          if (batch->cnt < PAGEDIR_BATCH_SIZE)
+            batch->pages[batch->cnt] = vpage;
+          batch->cnt++;
+        }
+    }
+}
+
+/* Performs the TLB invalidations collected in BATCH: one invlpg per
+   page, or a single full flush if there were more pages than
+   BATCH holds.  Nothing is needed if another page directory has
+   been activated meanwhile, since that flushed the TLB. */
+void
+pagedir_batch_flush (struct pagedir_batch *batch)
+{
+  if (batch->cnt > 0 && active_pd () == batch->pd)
+    {
+      if (batch->cnt > PAGEDIR_BATCH_SIZE)
+        pagedir_activate (batch->pd);
+      else
+        {
+          size_t i;
+
+          for (i = 0; i < batch->cnt; i++)
+            asm volatile ("invlpg (%0)" : : "r" (batch->pages[i])
+                          : "memory");
+        }
+    }
+  batch->cnt = 0;
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -243,21 +311,20 @@ active_pd (void)
   return ptov (pd);
 }
 
-/* Seom page table changes can cause the CPU's translation
+/* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VPAGE if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Only that entry is dropped, with invlpg, so the
+   translations of the rest of the working set survive; see
+   [IA32-v3a] 3.12 "Translation Lookaside Buffers (TLBs)". */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vpage) 
 {
   if (active_pd () == pd) 
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+    asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
 }
@@ -2,17 +2,36 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Number of pages whose TLB entries a pagedir_batch invalidates
+   one by one; beyond that it flushes the whole TLB. */
+#define PAGEDIR_BATCH_SIZE 32
+
+/* TLB invalidations deferred while many PTEs are changed. */
+struct pagedir_batch
+  {
+    uint32_t *pd;                       /* Page directory active at init. */
+    size_t cnt;                         /* Pages changed in PD. */
+    const void *pages[PAGEDIR_BATCH_SIZE];
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool writable);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
 
+void pagedir_batch_init (struct pagedir_batch *);
+void pagedir_clear_accessed (uint32_t *pd, const void *upage,
+                             struct pagedir_batch *);
+void pagedir_batch_flush (struct pagedir_batch *);
+
 #endif /* userprog/pagedir.h */
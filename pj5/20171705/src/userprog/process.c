@@ -1,4 +1,5 @@
 #include "userprog/process.h" 
+#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
 #include <round.h>
@@ -18,10 +19,15 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool copy_files (struct thread *parent);
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static void push_argument(int argc, char* argv[],void **esp);
 /* Starts a new thread running a user program loaded from
@@ -100,6 +106,126 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* If true, each process prints its paging statistics as it exits.
+   Set with -vmstat. */
+bool vmstat_on_exit;
+
+/* What fork() passes to the child's start_fork(). */
+struct fork_aux
+  {
+    struct thread *parent;
+    struct intr_frame if_;              /* Parent's syscall frame. */
+  };
+
+/* Starts a copy of the current process, which returns from the
+   system call in interrupt frame F with 0 where the parent gets
+   the child's thread id.  The child shares the parent's pages
+   copy-on-write instead of loading the executable again.  Returns
+   TID_ERROR if the copy cannot be made. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct fork_aux *aux;
+  tid_t tid;
+
+  aux = malloc (sizeof *aux);
+  if (aux == NULL)
+    return TID_ERROR;
+  aux->parent = thread_current ();
+  aux->if_ = *f;
+
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_fork, aux);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&thread_current ()->create_sema);
+      if (!thread_current ()->create_success)
+        {
+          /* The child is exiting.  Reap it here, since no one
+             will wait for a tid we never returned. */
+          process_wait (tid);
+          tid = TID_ERROR;
+        }
+    }
+  free (aux);
+  return tid;
+}
+
+/* A thread function that copies the forking process, which waits
+   on its create_sema meanwhile, and starts the copy running. */
+static void
+start_fork (void *aux_)
+{
+  struct fork_aux *aux = aux_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = aux->parent;
+  struct intr_frame if_ = aux->if_;
+  bool success;
+
+  hash_init (&cur->spt, hash_value, hash_compare, NULL);
+  cur->pagedir = pagedir_create ();
+  success = cur->pagedir != NULL;
+  if (success)
+    {
+      process_activate ();
+      success = spt_copy (parent) && copy_files (parent);
+    }
+
+  parent->create_success = success;
+  sema_up (&parent->create_sema);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread its own copies of PARENT's open files,
+   at the same positions, and of its working directory. */
+static bool
+copy_files (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->file_list); e != list_end (&parent->file_list);
+       e = list_next (e))
+    {
+      struct list_item *item = list_entry (e, struct list_item, elem);
+      struct list_item *copy = malloc (sizeof *copy);
+
+      if (copy == NULL)
+        return false;
+      copy->fd = item->fd;
+      copy->f = file_reopen (item->f);
+      copy->dir = item->dir != NULL ? dir_reopen (item->dir) : NULL;
+      if (copy->f == NULL)
+        {
+          free (copy);
+          return false;
+        }
+      file_seek (copy->f, file_tell (item->f));
+      list_push_back (&cur->file_list, &copy->elem);
+    }
+
+  if (parent->file_bitmap != NULL)
+    {
+      size_t i;
+
+      cur->file_bitmap = bitmap_create (bitmap_size (parent->file_bitmap));
+      if (cur->file_bitmap == NULL)
+        return false;
+      for (i = 0; i < bitmap_size (parent->file_bitmap); i++)
+        bitmap_set (cur->file_bitmap, i, bitmap_test (parent->file_bitmap, i));
+    }
+
+  if (parent->current_dir != NULL)
+    cur->current_dir = dir_reopen (parent->current_dir);
+  return true;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -135,6 +261,15 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+#ifdef VM
+  if (vmstat_on_exit && cur->pagedir != NULL)
+    printf ("%s: vmstat: %d major faults, %d minor faults, %d swap-ins, "
+            "%d swap-outs, %d resident, %d evictions\n",
+            cur->name, cur->vmstat.major_faults, cur->vmstat.minor_faults,
+            cur->vmstat.swap_ins, cur->vmstat.swap_outs,
+            cur->vmstat.resident, cur->vmstat.evictions);
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   struct list_elem* elem;
@@ -148,6 +283,7 @@ process_exit (void)
 	  }
   destroy_file_bitmap();
 #ifdef VM
+  munmap_all();
   hash_destroy(&cur->spt,spte_destroy);
 #endif
 
@@ -532,7 +668,6 @@ setup_stack (void **esp)
 
 #ifdef VM
   kpage = frame_allocate(((uint8_t *)PHYS_BASE)-PGSIZE,PAL_ZERO);
-  memset(kpage,0,PGSIZE);
 #else
   kpage = palloc_get_page(PAL_USER | PAL_ZERO);
 #endif
@@ -540,7 +675,12 @@ setup_stack (void **esp)
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
       if (success)
-        *esp = PHYS_BASE;
+        {
+          *esp = PHYS_BASE;
+#ifdef VM
+          frame_unpin (kpage);
+#endif
+        }
       else
 #ifdef VM
 	frame_free(kpage);	
@@ -7,5 +7,12 @@ tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+#ifdef VM
+extern bool vmstat_on_exit;
+
+struct intr_frame;
+tid_t process_fork (struct intr_frame *);
+#endif
+bool call_install_page (void *upage, void *kpage, bool writable);
 
 #endif /* userprog/process.h */
@@ -4,6 +4,10 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 static struct lock filesys_lock;
@@ -16,6 +20,12 @@ bool isdir(int fd);
 int inumber(int fd);
 #endif
 
+#ifdef VM
+int mmap(int fd,void *addr);
+void munmap(int mapid);
+int vmstat(struct vmstat *st);
+#endif
+
 struct list_item* get_fd(struct thread*,int fd,bool directory, bool file);
 
 void
@@ -74,6 +84,22 @@ syscall_handler (struct intr_frame *f)
 		  exit(-1);
 	f->eax = max_of_four_int(*(int*)(f->esp+4),*(int*)(f->esp+8),*(int*)(f->esp+12),*(int*)(f->esp+16));
   }
+  else if(syscall_no == SYS_FORK){
+#ifdef VM
+	f->eax = process_fork(f);
+#else
+	f->eax = -1;	/* needs the supplemental page table */
+#endif
+  }
+  else if(syscall_no == SYS_VMSTAT){
+	  if(!is_user_vaddr(f->esp + 4))
+		  exit(-1);
+#ifdef VM
+	f->eax = vmstat(*(struct vmstat**)(f->esp + 4));
+#else
+	f->eax = -1;
+#endif
+  }
   else if(syscall_no == SYS_CREATE){
 	if(!is_user_vaddr(f->esp+4) || !is_user_vaddr(f->esp + 8))
 		exit(-1);
@@ -163,6 +189,19 @@ syscall_handler (struct intr_frame *f)
 
 #endif
 
+#ifdef VM
+  else if(syscall_no == SYS_MMAP){
+	  if(!is_user_vaddr(f->esp + 4) || !is_user_vaddr(f->esp + 8))
+		  exit(-1);
+	  f->eax = mmap(*(int*)(f->esp + 4),*(void**)(f->esp + 8));
+  }
+  else if(syscall_no == SYS_MUNMAP){
+	  if(!is_user_vaddr(f->esp + 4))
+		  exit(-1);
+	  munmap(*(int*)(f->esp + 4));
+  }
+#endif
+
   //thread_exit ();
 }
 
@@ -535,3 +574,48 @@ struct list_item* get_fd(struct thread *t,int fd,bool directory,bool file)
 	}
 	return NULL;
 }
+
+#ifdef VM
+
+int mmap(int fd,void *addr)
+{
+	struct list_elem* elem;
+	struct list_item* item;
+	int mapid = -1;
+
+	if(fd == 0 || fd == 1)
+		return -1;
+	for(elem = list_begin(&(thread_current()->file_list));
+		elem != list_end(&(thread_current()->file_list)); elem = list_next(elem)){
+		if((item = list_entry(elem,struct list_item,elem))->fd == fd){
+			if(item->dir != NULL)
+				return -1;
+			lock_acquire(&filesys_lock);
+			mapid = mmap_file(item->f,addr);
+			lock_release(&filesys_lock);
+			break;
+		}
+	}
+	return mapid;
+}
+
+void munmap(int mapid)
+{
+	struct mmap_e *m = mmap_lookup(mapid);
+
+	if(m == NULL)
+		return;
+	lock_acquire(&filesys_lock);
+	munmap_file(m);
+	lock_release(&filesys_lock);
+}
+
+int vmstat(struct vmstat *st)
+{
+	if(st == NULL || !is_user_vaddr(st) || !is_user_vaddr(st + 1))
+		exit(-1);
+	*st = thread_current()->vmstat;
+	return 0;
+}
+
+#endif
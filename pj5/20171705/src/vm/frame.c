@@ -1,83 +1,245 @@
 #include "frame.h"
 #include "swap.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 
-static struct list frame_list;
-static struct lock frame_lock;
+static struct frame_e *frame_table;	/* One entry per user pool page. */
+static uint8_t *frame_base;		/* Kernel address of frame 0. */
+static size_t frame_cnt;
+static size_t clock_hand;		/* Next frame the clock looks at. */
+static size_t low_water;		/* Free frames kept for demand faults. */
+static struct lock frame_lock;		/* Guards the table and the hand. */
 
-struct list_elem *clock;
+/* Frames holding read-only file pages, by inode and offset. */
+static struct hash text_frames;
 
-void init_frame_list(void)
+/* Statistics. */
+static long long evict_drop_cnt;	/* # of clean file pages dropped. */
+static long long evict_swap_cnt;	/* # of pages written to swap. */
+static long long evict_write_cnt;	/* # of mapped pages written back. */
+static long long cow_share_cnt;		/* # of pages shared by fork(). */
+static long long cow_copy_cnt;		/* # of shared pages copied on write. */
+static long long text_share_cnt;	/* # of faults served by text_frames. */
+
+static bool evict(struct frame_e *fe);
+static void *get_frame(enum palloc_flags flags);
+static unsigned text_hash(const struct hash_elem *e,void *aux);
+static bool text_less(const struct hash_elem *a,const struct hash_elem *b,void *aux);
+static void text_forget(struct frame_e *fe);
+static void add_mapper(struct frame_e *fe,struct spt_e *spte);
+static void remove_mapper(struct frame_e *fe,struct spt_e *spte);
+
+/* Sizes the frame table from the user pool and allocates it from
+   the kernel pool.  Must run after palloc_init(). */
+void init_frame_table(void)
 {
-	list_init(&frame_list);
-	clock = list_begin(&frame_list);
+	void *base;
+	size_t pages, i;
+
+	palloc_user_pool(&base,&frame_cnt);
+	frame_base = base;
+	pages = DIV_ROUND_UP(frame_cnt * sizeof *frame_table, PGSIZE);
+	frame_table = palloc_get_multiple(PAL_ASSERT|PAL_ZERO,pages);
+	for(i=0; i<frame_cnt; i++){
+		frame_table[i].kaddr = frame_base + i*PGSIZE;
+		list_init(&frame_table[i].mappers);
+	}
+	clock_hand = 0;
+	low_water = frame_cnt / 16;
 	lock_init(&frame_lock);
+	hash_init(&text_frames,text_hash,text_less,NULL);
 }
 
-void insert_frame_e(struct list_elem* e)
+/* Prints eviction statistics. */
+void frame_print_stats(void)
 {
-	lock_acquire(&frame_lock);
-	list_push_back(&frame_list,e);
-	lock_release(&frame_lock);
+	printf("Frames: %zu, %lld evictions dropped clean file pages, "
+	       "%lld wrote to swap, %lld wrote back mapped files\n",
+	       frame_cnt,evict_drop_cnt,evict_swap_cnt,evict_write_cnt);
+	printf("Frames: %lld pages shared copy-on-write, %lld copied\n",
+	       cow_share_cnt,cow_copy_cnt);
+	printf("Frames: %lld faults mapped another process's text page\n",
+	       text_share_cnt);
 }
 
-struct frame_e* free_frame()
+/* Returns the entry for the user pool page at KADDR. */
+struct frame_e* frame_lookup(void *kaddr)
 {
-	struct frame_e *fe;
-	
-	int j= list_size(&frame_list);
-	for(int i=0; i<=2*j; i++)
+	size_t idx = pg_no(kaddr) - pg_no(frame_base);
+
+	ASSERT(pg_ofs(kaddr) == 0);
+	ASSERT(idx < frame_cnt);
+	return &frame_table[idx];
+}
+
+/* Picks a frame to evict with the clock algorithm, giving frames
+   whose page was accessed, in any of its mappers' page tables, a
+   second chance.  Free and pinned frames are skipped.  The accessed bits
+   cleared on the way are flushed from the TLB once, at the end of
+   the sweep.  Returns NULL if no frame can be evicted.
+   frame_lock must be held. */
+struct frame_e* free_frame(void)
+{
+	struct pagedir_batch batch;
+	struct frame_e *victim = NULL;
+	size_t i;
+
+	ASSERT(lock_held_by_current_thread(&frame_lock));
+	pagedir_batch_init(&batch);
+	for(i=0; i<2*frame_cnt && victim == NULL; i++)
 	{
-		fe = clock_next();
-		if(pagedir_is_accessed(thread_current()->pagedir,fe->spte->vaddr)){
-			pagedir_set_accessed(thread_current()->pagedir,fe->spte->vaddr,false);	
-		}
-		
-		else{
-			break;
+		struct frame_e *fe = clock_next();
+		struct list_elem *e;
+		bool accessed = false;
+
+		if(fe->ref_cnt == 0 || fe->pin_cnt > 0)
+			continue;
+		for(e = list_begin(&fe->mappers); e != list_end(&fe->mappers); e = list_next(e)){
+			struct spt_e *spte = list_entry(e,struct spt_e,frame_elem);
+			uint32_t *pd = spte->t->pagedir;
+
+			if(pagedir_is_accessed(pd,spte->vaddr)){
+				pagedir_clear_accessed(pd,spte->vaddr,&batch);
+				accessed = true;
+			}
 		}
+		if(!accessed)
+			victim = fe;
 	}
-	return fe;
+	pagedir_batch_flush(&batch);
+	return victim;
 }
 
+/* Records that the frame at KADDR, which must be free, holds
+   SPTE's page.  The frame starts out pinned. */
 void add_frame_e(struct spt_e* spte,void *kaddr){
-      	struct frame_e *fe = (struct frame_e*)malloc(sizeof(struct frame_e));
-	fe->kaddr = kaddr;
- 	fe->t = thread_current();
-	fe->spte = spte;
-      	insert_frame_e(&fe->elem);	
+	struct frame_e *fe = frame_lookup(kaddr);
+
+	lock_acquire(&frame_lock);
+	ASSERT(fe->ref_cnt == 0);
+	add_mapper(fe,spte);
+	fe->pin_cnt = 1;
+	lock_release(&frame_lock);
 }
 
-struct frame_e* clock_next()
+/* Returns the frame under the clock hand and advances it. */
+struct frame_e* clock_next(void)
 {
-	if(clock == NULL || clock == list_end(&frame_list))
-		clock = list_begin(&frame_list);
-	else
-		clock = list_next(&frame_list);
-
-	//struct frame_e *e = list_entry(clock,struct frame_e,elem);
-	return list_entry(clock,struct frame_e,elem);
+	struct frame_e *fe = &frame_table[clock_hand];
 
-	//return e;
+	if(++clock_hand >= frame_cnt)
+		clock_hand = 0;
+	return fe;
 }
 
-void* frame_allocate(void* upage,enum palloc_flags flags){
+/* Unmaps FE's page from all of its mappers, leaving FE free but
+   still allocated.  A page that is still as it was read from its
+   file is simply dropped, to be read again on the next fault; a
+   modified page of a mapped file is written back to the file
+   first; any other page is written to swap once, with every
+   mapper sharing the slot.  Returns false, with the page still
+   mapped, if swap is full.  frame_lock must be held. */
+static bool evict(struct frame_e *fe)
+{
+	struct list_elem *e;
+	struct spt_e *spte;
+	bool dirty = false, anon = false;
+	int slot = -1;
+
+	/* Unmap first, so no mapper can change the page while it is
+	   written; if one faults on it meanwhile, it waits for
+	   frame_lock in frame_allocate(). */
+	fe->pin_cnt++;
+	for(e = list_begin(&fe->mappers); e != list_end(&fe->mappers); e = list_next(e)){
+		spte = list_entry(e,struct spt_e,frame_elem);
+		pagedir_clear_page(spte->t->pagedir,spte->vaddr);
+		dirty |= pagedir_is_dirty(spte->t->pagedir,spte->vaddr);
+		anon |= spte->type == PAGE_ANON;
+	}
+	spte = list_entry(list_front(&fe->mappers),struct spt_e,frame_elem);
+
+	if(spte->type == PAGE_MMAP && dirty){
+		/* Mapped files are never shared, so SPTE is the only mapper. */
+		file_write_at(spte->file,fe->kaddr,spte->page_read_bytes,spte->ofs);
+		evict_write_cnt++;
+	}
+	else if(dirty || anon){
+		slot = swap_to_disk(fe->kaddr);
+		if(slot == -1){
+			for(e = list_begin(&fe->mappers); e != list_end(&fe->mappers); e = list_next(e)){
+				spte = list_entry(e,struct spt_e,frame_elem);
+				pagedir_set_page(spte->t->pagedir,spte->vaddr,fe->kaddr,
+						 spte->writable && !spte->cow);
+				/* The new entry starts clean; keep the write, or the
+				   next eviction would drop the page as unmodified. */
+				if(dirty)
+					pagedir_set_dirty(spte->t->pagedir,spte->vaddr,true);
+			}
+			fe->pin_cnt--;
+			return false;
+		}
+		evict_swap_cnt++;
+	}
+	else
+		evict_drop_cnt++;
+
+	while(!list_empty(&fe->mappers)){
+		spte = list_entry(list_front(&fe->mappers),struct spt_e,frame_elem);
+		remove_mapper(fe,spte);
+		if(slot != -1){
+			if(!list_empty(&fe->mappers))
+				swap_ref(slot);	/* one reference per mapper */
+			spte->swap_slot = slot;
+			spte->type = PAGE_ANON;	/* file copy is stale for good */
+			spte->t->vmstat.swap_outs++;
+		}
+		spte->t->vmstat.evictions++;
+		spte->kpage = NULL;
+	}
+	fe->pin_cnt--;
+	text_forget(fe);
+	return true;
+}
 
+/* Returns a free user frame, evicting a page if the user pool is
+   exhausted, or NULL if no frame could be found.  The frame is in
+   no mapper's list, so the clock leaves it alone until it is
+   added to one. */
+static void *get_frame(enum palloc_flags flags)
+{
 	void *frame = palloc_get_page(PAL_USER|flags);
 
 	if(frame == NULL){
-		struct frame_e* evicted = free_frame();
-		evicted->spte->swap_slot = swap_to_disk(evicted->kaddr);
-		pagedir_clear_page(evicted->t->pagedir,evicted->spte->vaddr);
-		frame_free(evicted->kaddr);
+		struct frame_e* evicted;
 
-		frame = palloc_get_page(PAL_USER|flags);
+		lock_acquire(&frame_lock);
+		evicted = free_frame();
+		if(evicted != NULL && evict(evicted))
+			frame = evicted->kaddr;
+		lock_release(&frame_lock);
 
-		if(frame == NULL){
-			printf("frame is NULL\n");
-			exit(-1);
-		}
+		if(frame != NULL && (flags & PAL_ZERO))
+			memset(frame,0,PGSIZE);
 	}
+	return frame;
+}
+
+/* Obtains a user frame for UPAGE of the current thread, evicting
+   another page if the user pool is exhausted.  The frame is
+   returned pinned; call frame_unpin() once it is mapped.
+   Returns NULL if no frame could be found. */
+void* frame_allocate(void* upage,enum palloc_flags flags){
+
+	void *frame = get_frame(flags);
+
+	if(frame == NULL)
+		return NULL;
 	
 	struct spt_e find_e;
 	find_e.vaddr = upage;
@@ -94,33 +256,280 @@ void* frame_allocate(void* upage,enum palloc_flags flags){
 	return frame;
 }
 
-void frame_free_without_palloc(void* kpage){
+/* Obtains a free user frame for SPTE, which must be in the current
+   thread's table, for a page read ahead of use.  Nothing is
+   evicted, and the last free frames are left to demand faults:
+   returns NULL once no more than frame_cnt / 16 remain.  The
+   frame is returned pinned, as by frame_allocate(). */
+void* frame_try_allocate(struct spt_e *spte){
+	void *frame;
+
+	if(palloc_user_free_cnt() <= low_water)
+		return NULL;
+	frame = palloc_get_page(PAL_USER);
+	if(frame != NULL)
+		add_frame_e(spte,frame);
+	return frame;
+}
+
+/* Keeps the frame at KADDR from being evicted until a matching
+   frame_unpin().  Pins nest, so threads sharing the frame can
+   each hold one. */
+void frame_pin(void *kaddr){
+	lock_acquire(&frame_lock);
+	frame_lookup(kaddr)->pin_cnt++;
+	lock_release(&frame_lock);
+}
+
+/* Pins the frame holding SPTE's page and returns its kernel
+   address, or returns NULL if the page is not in memory.  Checked
+   under frame_lock, so the page cannot be evicted in between. */
+void* frame_pin_page(struct spt_e *spte){
+	void *kaddr;
 
 	lock_acquire(&frame_lock);
-	struct list_elem *e;
-	for(e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)){
-		struct frame_e *fe = list_entry(e,struct frame_e,elem);
-		if(fe->kaddr == kpage){
-			list_remove(&fe->elem);
-			free(fe);
-			break;
+	kaddr = spte->kpage;
+	if(kaddr != NULL)
+		frame_lookup(kaddr)->pin_cnt++;
+	lock_release(&frame_lock);
+	return kaddr;
+}
+
+/* Drops a pin taken by frame_pin(), frame_pin_page(), or
+   frame_allocate() on the frame at KADDR.  The frame can be
+   evicted again once no pins are left. */
+void frame_unpin(void *kaddr){
+	struct frame_e *fe;
+
+	lock_acquire(&frame_lock);
+	fe = frame_lookup(kaddr);
+	ASSERT(fe->pin_cnt > 0);
+	fe->pin_cnt--;
+	lock_release(&frame_lock);
+}
+
+/* Makes CHILD, the current thread's copy of PARENT's entry,
+   share PARENT's frame, if it has one, or its swap slot.  A
+   writable page becomes copy-on-write for both: it is mapped
+   read-only until one of them writes it, and frame_break_cow()
+   gives the writer a copy of its own.  Returns false if CHILD's
+   page table cannot be extended. */
+bool frame_share(struct spt_e *parent,struct spt_e *child){
+	uint32_t *ppd = parent->t->pagedir;
+	bool success = true;
+
+	lock_acquire(&frame_lock);
+	if(parent->kpage != NULL){
+		struct frame_e *fe = frame_lookup(parent->kpage);
+
+		/* The file copy is stale once the page has been written,
+		   and only the writer's page table says so. */
+		if(pagedir_is_dirty(ppd,parent->vaddr))
+			parent->type = PAGE_ANON;
+		child->type = parent->type;
+		if(parent->writable && !parent->cow){
+			parent->cow = true;
+			pagedir_set_writable(ppd,parent->vaddr,false);
 		}
+		child->cow = parent->writable;
+		success = pagedir_set_page(child->t->pagedir,child->vaddr,parent->kpage,false);
+		if(success){
+			child->kpage = parent->kpage;
+			add_mapper(fe,child);
+			cow_share_cnt++;
+		}
+	}
+	else if(parent->swap_slot != -1){
+		/* Each sharer reads its own copy back in. */
+		child->type = PAGE_ANON;
+		swap_ref(parent->swap_slot);
+		child->swap_slot = parent->swap_slot;
 	}
 	lock_release(&frame_lock);
+	return success;
+}
+
+/* Returns true if SPTE's page can be shared with every other
+   process mapping the same page of the same file: it is read-only
+   and still as read from the file. */
+static bool is_text(struct spt_e *spte)
+{
+	return spte->type == PAGE_FILE && !spte->writable;
 }
-void frame_free(void* kpage){
+
+/* If another process has SPTE's page, a page of the current
+   thread, in a frame, maps that frame at SPTE too and returns
+   true.  Otherwise returns false, and the caller reads the page
+   in and offers it with frame_register_text(). */
+bool frame_share_text(struct spt_e *spte){
+	struct frame_e key, *fe;
+	struct hash_elem *e;
+	bool success = false;
+
+	if(!is_text(spte))
+		return false;
+	key.text_inode = file_get_inode(spte->file);
+	key.text_ofs = spte->ofs;
 
 	lock_acquire(&frame_lock);
-	struct list_elem *e;
-	for(e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)){
-		struct frame_e *fe = list_entry(e,struct frame_e,elem);
-		if(fe->kaddr == kpage){
-			list_remove(&fe->elem);
-			free(fe);
-			break;
+	e = hash_find(&text_frames,&key.text_elem);
+	if(e != NULL){
+		fe = hash_entry(e,struct frame_e,text_elem);
+		if(pagedir_set_page(spte->t->pagedir,spte->vaddr,fe->kaddr,false)){
+			add_mapper(fe,spte);
+			spte->kpage = fe->kaddr;
+			spte->cow = false;
+			text_share_cnt++;
+			success = true;
 		}
 	}
-	if(kpage != NULL)
-		palloc_free_page(kpage);	
 	lock_release(&frame_lock);
+	return success;
+}
+
+/* Lets other processes share the frame into which SPTE's page has
+   just been read, if it is a read-only page of a file and no frame
+   already holds that page. */
+void frame_register_text(struct spt_e *spte){
+	struct frame_e *fe;
+
+	if(!is_text(spte))
+		return;
+	lock_acquire(&frame_lock);
+	fe = frame_lookup(spte->kpage);
+	if(fe->text_inode == NULL){
+		fe->text_inode = file_get_inode(spte->file);
+		fe->text_ofs = spte->ofs;
+		if(hash_insert(&text_frames,&fe->text_elem) != NULL)
+			fe->text_inode = NULL;
+	}
+	lock_release(&frame_lock);
+}
+
+/* Adds SPTE to FE's mappers, counting the frame as resident for
+   SPTE's owner.  frame_lock must be held. */
+static void add_mapper(struct frame_e *fe,struct spt_e *spte)
+{
+	list_push_back(&fe->mappers,&spte->frame_elem);
+	fe->ref_cnt++;
+	spte->t->vmstat.resident++;
+}
+
+/* Removes SPTE from FE's mappers.  frame_lock must be held. */
+static void remove_mapper(struct frame_e *fe,struct spt_e *spte)
+{
+	list_remove(&spte->frame_elem);
+	fe->ref_cnt--;
+	spte->t->vmstat.resident--;
+}
+
+/* Removes FE, which no longer holds its page, from text_frames.
+   frame_lock must be held. */
+static void text_forget(struct frame_e *fe)
+{
+	if(fe->text_inode != NULL){
+		hash_delete(&text_frames,&fe->text_elem);
+		fe->text_inode = NULL;
+	}
+}
+
+/* Hashes a text frame by inode and offset.  Executables stay open
+   while any process runs them, so the inode pointer identifies the
+   file for as long as a frame can hold one of its pages. */
+static unsigned text_hash(const struct hash_elem *e,void *aux UNUSED)
+{
+	const struct frame_e *fe = hash_entry(e,struct frame_e,text_elem);
+
+	return hash_bytes(&fe->text_inode,sizeof fe->text_inode) ^ hash_int(fe->text_ofs);
+}
+
+static bool text_less(const struct hash_elem *a,const struct hash_elem *b,void *aux UNUSED)
+{
+	const struct frame_e *x = hash_entry(a,struct frame_e,text_elem);
+	const struct frame_e *y = hash_entry(b,struct frame_e,text_elem);
+
+	if(x->text_inode != y->text_inode)
+		return x->text_inode < y->text_inode;
+	return x->text_ofs < y->text_ofs;
+}
+
+/* Handles a write to SPTE, a copy-on-write page of the current
+   thread: copies the page into a frame of its own, or just maps
+   it writable if no one else shares it any more.  Returns false
+   if no frame is left for the copy. */
+bool frame_break_cow(struct spt_e *spte){
+	uint32_t *pd = thread_current()->pagedir;
+	struct frame_e *fe, *copy_fe;
+	void *old, *copy;
+
+	old = frame_pin_page(spte);
+	if(old == NULL)
+		return true;	/* evicted meanwhile: it faults in privately */
+	fe = frame_lookup(old);
+
+	lock_acquire(&frame_lock);
+	if(fe->ref_cnt == 1){
+		spte->cow = false;
+		pagedir_set_writable(pd,spte->vaddr,true);
+		fe->pin_cnt--;
+		lock_release(&frame_lock);
+		return true;
+	}
+	lock_release(&frame_lock);
+
+	copy = get_frame(0);
+	if(copy == NULL){
+		frame_unpin(old);
+		return false;
+	}
+	memcpy(copy,old,PGSIZE);
+
+	lock_acquire(&frame_lock);
+	remove_mapper(fe,spte);
+	fe->pin_cnt--;
+	copy_fe = frame_lookup(copy);
+	add_mapper(copy_fe,spte);
+	spte->kpage = copy;
+	spte->cow = false;
+	pagedir_clear_page(pd,spte->vaddr);
+	pagedir_set_page(pd,spte->vaddr,copy,spte->writable);
+	cow_copy_cnt++;
+	lock_release(&frame_lock);
+	return true;
+}
+
+/* Removes SPTE, a page of the current thread, from its frame and
+   page table, freeing the frame if no one else maps it. */
+void frame_release(struct spt_e *spte){
+	struct frame_e *fe;
+
+	lock_acquire(&frame_lock);
+	if(spte->kpage != NULL){
+		fe = frame_lookup(spte->kpage);
+		remove_mapper(fe,spte);
+		pagedir_clear_page(spte->t->pagedir,spte->vaddr);
+		spte->kpage = NULL;
+		if(fe->ref_cnt == 0){
+			fe->pin_cnt = 0;
+			text_forget(fe);
+			palloc_free_page(fe->kaddr);
+		}
+	}
+	lock_release(&frame_lock);
+}
+
+/* Frees the frame at KPAGE, forgetting the page it held. */
+void frame_free(void* kpage){
+	struct frame_e *fe;
+
+	if(kpage == NULL)
+		return;
+	lock_acquire(&frame_lock);
+	fe = frame_lookup(kpage);
+	while(!list_empty(&fe->mappers))
+		remove_mapper(fe,list_entry(list_front(&fe->mappers),struct spt_e,frame_elem));
+	fe->pin_cnt = 0;
+	text_forget(fe);
+	lock_release(&frame_lock);
+	palloc_free_page(kpage);	
 }
@@ -4,24 +4,42 @@
 #include "page.h"
 #include "threads/palloc.h"
 
+/* A page of the user pool.  The frame table holds one per page,
+   indexed by frame number, so a frame is found from its kernel
+   address without searching. */
 struct frame_e{
-	struct list_elem elem;
-	struct thread *t;
 	void *kaddr;
-	struct spt_e *spte;
+	struct list mappers;	/* spt_e's of the pages held, by frame_elem. */
+	int ref_cnt;		/* Length of mappers; 0 if the frame is free. */
+	unsigned pin_cnt;	/* Pins held; never evicted while nonzero. */
+
+	/* Set while the frame holds a read-only page of a file, which
+	   other processes mapping the same page share. */
+	struct inode *text_inode;
+	size_t text_ofs;
+	struct hash_elem text_elem;	/* In frame.c's text_frames. */
 };
 
-void init_frame_list(void);
+void init_frame_table(void);
+void frame_print_stats(void);
 
-void insert_frame_e(struct list_elem *e);
-
-struct frame_e* free_frame();
+struct frame_e* frame_lookup(void *kaddr);
+struct frame_e* free_frame(void);
 
 void add_frame_e(struct spt_e* spte,void *kaddr);
-struct frame_e* clock_next();
+struct frame_e* clock_next(void);
 
 void* frame_allocate(void* upage,enum palloc_flags flags);
+void* frame_try_allocate(struct spt_e *spte);
+void frame_pin(void *kaddr);
+void* frame_pin_page(struct spt_e *spte);
+void frame_unpin(void *kaddr);
+
+bool frame_share(struct spt_e *parent,struct spt_e *child);
+bool frame_share_text(struct spt_e *spte);
+void frame_register_text(struct spt_e *spte);
+bool frame_break_cow(struct spt_e *spte);
 
+void frame_release(struct spt_e *spte);
 void frame_free(void*);
-void frame_free_without_palloc(void* kpage);
 #endif
@@ -1,6 +1,11 @@
 #include "page.h"
 #include "frame.h"
+#include "swap.h"
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 
 unsigned hash_value(const struct hash_elem* e,void *aux)
 {
@@ -20,14 +25,19 @@ void spte_destroy(struct hash_elem *elem,void *aux)
 {
 	struct spt_e *spte = hash_entry(elem,struct spt_e,elem);
 
-	if(spte->kpage != NULL){
-		frame_free_without_palloc(spte->kpage);	
-	}
+	frame_release(spte);
+	if(spte->zero)	/* keep pagedir_destroy() from freeing it */
+		pagedir_clear_page(spte->t->pagedir,spte->vaddr);
+	if(spte->swap_slot != -1)
+		swap_free(spte->swap_slot);
 	free(spte);
 }
 
-void add_spte(void* upage,void* kpage,size_t page_read_bytes,size_t page_zero_bytes,bool writable,struct file* file,size_t ofs){
+struct spt_e* add_spte(void* upage,void* kpage,size_t page_read_bytes,size_t page_zero_bytes,bool writable,struct file* file,size_t ofs){
 	struct spt_e *spte = (struct spte *)malloc(sizeof(struct spt_e)); //insert spte
+	if(spte == NULL)
+		return NULL;
+	spte->t = thread_current();
 	spte->vaddr = upage;
 	spte->kpage = kpage;
 	spte->page_read_bytes = page_read_bytes;
@@ -36,5 +46,154 @@ void add_spte(void* upage,void* kpage,size_t page_read_bytes,size_t page_zero_by
  	spte->file = file;
  	spte->ofs = ofs;
 	spte->swap_slot = -1;
+	spte->type = file != NULL ? PAGE_FILE : PAGE_ANON;
+	spte->cow = false;
+	spte->zero = false;
 	hash_insert(&thread_current()->spt,&(spte->elem));
+	return spte;
+}
+
+/* Maps the whole of FILE at ADDR in the current process.  Nothing
+   is read yet: each page faults in from the file on first touch,
+   through the buffer cache, like the executable's pages.  Returns
+   the mapping's id, or -1 if FILE is empty, ADDR is not page
+   aligned, any page of the range is already in use, or memory
+   runs out. */
+int mmap_file(struct file *file,void *addr)
+{
+	struct thread *t = thread_current();
+	struct mmap_e *m;
+	struct spt_e find_e;
+	off_t length = file_length(file);
+	size_t page_cnt = DIV_ROUND_UP((size_t) length,PGSIZE);
+	size_t i;
+
+	if(addr == NULL || pg_ofs(addr) != 0 || length == 0)
+		return -1;
+	for(i=0; i<page_cnt; i++){
+		find_e.vaddr = (uint8_t *)addr + i*PGSIZE;
+		if(!is_user_vaddr(find_e.vaddr) || hash_find(&t->spt,&find_e.elem) != NULL)
+			return -1;
+	}
+
+	m = malloc(sizeof *m);
+	if(m == NULL)
+		return -1;
+	m->file = file_reopen(file);
+	if(m->file == NULL){
+		free(m);
+		return -1;
+	}
+	m->addr = addr;
+	m->page_cnt = page_cnt;
+	for(i=0; i<m->page_cnt; i++){
+		size_t ofs = i*PGSIZE;
+		off_t left = length - (off_t) ofs;
+		size_t read_bytes = left < PGSIZE ? left : PGSIZE;
+		struct spt_e *spte = add_spte((uint8_t *)addr + ofs,NULL,read_bytes,
+					      PGSIZE - read_bytes,true,m->file,ofs);
+		if(spte == NULL){
+			/* Out of memory: undo the pages added so far.  None
+			   has been touched, so none is in a frame. */
+			while(i-- > 0){
+				struct hash_elem *e;
+
+				find_e.vaddr = (uint8_t *)addr + i*PGSIZE;
+				e = hash_delete(&t->spt,&find_e.elem);
+				free(hash_entry(e,struct spt_e,elem));
+			}
+			file_close(m->file);
+			free(m);
+			return -1;
+		}
+		spte->type = PAGE_MMAP;
+	}
+	m->mapid = t->next_mapid++;
+	list_push_back(&t->mmap_list,&m->elem);
+	return m->mapid;
+}
+
+/* Returns the current process's mapping with id MAPID, or NULL. */
+struct mmap_e* mmap_lookup(int mapid)
+{
+	struct thread *t = thread_current();
+	struct list_elem *e;
+
+	for(e = list_begin(&t->mmap_list); e != list_end(&t->mmap_list); e = list_next(e)){
+		struct mmap_e *m = list_entry(e,struct mmap_e,elem);
+		if(m->mapid == mapid)
+			return m;
+	}
+	return NULL;
+}
+
+/* Removes mapping M from the current process, first writing each
+   resident page the process has modified back to the file. */
+void munmap_file(struct mmap_e *m)
+{
+	struct thread *t = thread_current();
+	struct spt_e find_e;
+	size_t i;
+
+	for(i=0; i<m->page_cnt; i++){
+		struct hash_elem *e;
+		struct spt_e *spte;
+		void *kpage;
+
+		find_e.vaddr = (uint8_t *)m->addr + i*PGSIZE;
+		e = hash_find(&t->spt,&find_e.elem);
+		if(e == NULL)
+			continue;
+		spte = hash_entry(e,struct spt_e,elem);
+
+		/* Pinned, the page cannot be evicted while it is written. */
+		kpage = frame_pin_page(spte);
+		if(kpage != NULL){
+			if(pagedir_is_dirty(t->pagedir,spte->vaddr))
+				file_write_at(m->file,kpage,spte->page_read_bytes,spte->ofs);
+			pagedir_clear_page(t->pagedir,spte->vaddr);
+			frame_free(kpage);
+		}
+		hash_delete(&t->spt,&spte->elem);
+		free(spte);
+	}
+	file_close(m->file);
+	list_remove(&m->elem);
+	free(m);
+}
+
+/* Removes all of the current process's mappings. */
+void munmap_all(void)
+{
+	struct thread *t = thread_current();
+
+	while(!list_empty(&t->mmap_list))
+		munmap_file(list_entry(list_front(&t->mmap_list),struct mmap_e,elem));
+}
+
+/* Copies PARENT's supplemental page table into the current thread's,
+   for fork().  Resident and swapped pages are shared with PARENT,
+   copy-on-write; pages still in their file are read in again by
+   each process.  Mapped files are not inherited.  PARENT must stay
+   blocked meanwhile.  Returns false if out of memory. */
+bool spt_copy(struct thread *parent)
+{
+	struct hash_iterator i;
+
+	hash_first(&i,&parent->spt);
+	while(hash_next(&i)){
+		struct spt_e *p = hash_entry(hash_cur(&i),struct spt_e,elem);
+		struct spt_e *c;
+
+		if(p->type == PAGE_MMAP)
+			continue;
+		c = add_spte(p->vaddr,NULL,p->page_read_bytes,p->page_zero_bytes,
+			     p->writable,p->file,p->ofs);
+		if(c == NULL)
+			return false;
+		c->type = p->type;
+		if(!frame_share(p,c))
+			return false;
+	}
+	return true;
 }
@@ -3,7 +3,15 @@
 #include <hash.h>
 #include <threads/thread.h>
 
+/* Where a page's contents are when it is not in memory. */
+enum page_type{
+	PAGE_FILE,	/* Still as read from file at ofs; dropped on eviction. */
+	PAGE_ANON,	/* Only in memory, or in swap_slot. */
+	PAGE_MMAP	/* Mapped from file at ofs; written back if dirty. */
+};
+
 struct spt_e{
+	struct thread *t;	/* Owner, whose pagedir maps vaddr. */
 	void *vaddr;
 	void *kpage;
 	size_t page_read_bytes;
@@ -13,6 +21,10 @@ struct spt_e{
 	struct hash_elem elem;
 	size_t ofs;
 	int swap_slot;
+	enum page_type type;
+	bool cow;		/* Shared read-only until written. */
+	bool zero;		/* Mapped to the zero page until written. */
+	struct list_elem frame_elem;	/* In its frame's mappers while kpage is set. */
 };
 
 unsigned hash_value(const struct hash_elem* e,void *aux);
@@ -21,6 +33,22 @@ bool hash_compare(const struct hash_elem *a,const struct hash_elem *b,void *aux)
 
 void spte_destroy(struct hash_elem *elem,void *aux);
 
-void add_spte(void* upage,void* kpage,size_t page_read_bytes,size_t page_zero_bytes,bool writable,struct file* file,size_t ofs);
+struct spt_e* add_spte(void* upage,void* kpage,size_t page_read_bytes,size_t page_zero_bytes,bool writable,struct file* file,size_t ofs);
+
+/* A file mapped with mmap(), one per thread's mmap_list. */
+struct mmap_e{
+	int mapid;
+	struct file *file;	/* Own reopened copy of the file. */
+	void *addr;		/* First mapped page. */
+	size_t page_cnt;
+	struct list_elem elem;
+};
+
+int mmap_file(struct file *file,void *addr);
+struct mmap_e* mmap_lookup(int mapid);
+void munmap_file(struct mmap_e *m);
+void munmap_all(void);
+
+bool spt_copy(struct thread *parent);
 
 #endif
@@ -1,53 +1,123 @@
 #include "swap.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "lib/kernel/bitmap.h"
 
-static struct bitmap *swap_bitmap;
+/* Sectors per swap slot, which holds one page. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
 
-void init_swap_bitmap()
+static struct block *swap_block;	/* NULL if there is no swap device. */
+static struct bitmap *swap_bitmap;	/* Slots in use. */
+static uint16_t *swap_refs;		/* # of pages sharing each slot. */
+static size_t swap_cursor;		/* Where the next slot search starts. */
+static struct lock swap_lock;		/* Guards the above. */
+
+/* Statistics. */
+static long long swap_out_cnt;		/* # of pages written. */
+static long long swap_in_cnt;		/* # of pages read. */
+
+/* Sizes the swap map from the swap device, one slot per page. */
+void init_swap_bitmap(void)
 {
-	swap_bitmap = bitmap_create(1024);
+	size_t slot_cnt = 0;
+
+	swap_block = block_get_role(BLOCK_SWAP);
+	if(swap_block != NULL)
+		slot_cnt = block_size(swap_block) / SECTORS_PER_SLOT;
+	swap_bitmap = bitmap_create(slot_cnt);
+	swap_refs = calloc(slot_cnt, sizeof *swap_refs);
+	if(swap_bitmap == NULL || (slot_cnt > 0 && swap_refs == NULL))
+		PANIC("swap map creation failed--swap device is too large");
+	swap_cursor = 0;
+	lock_init(&swap_lock);
 }
-void destroy_swap_bitmap()
+void destroy_swap_bitmap(void)
 {
 	bitmap_destroy(swap_bitmap);
+	free(swap_refs);
+}
+
+/* Prints swap statistics. */
+void swap_print_stats(void)
+{
+	if(swap_bitmap == NULL)
+		return;
+	printf("Swap: %zu slots, %zu in use, %lld pages out, %lld pages in\n",
+	       bitmap_size(swap_bitmap),
+	       bitmap_count(swap_bitmap,0,bitmap_size(swap_bitmap),true),
+	       swap_out_cnt,swap_in_cnt);
 }
 
-int find_swap_slot()
+/* Claims a free slot, searching on from the last one claimed so
+   that pages evicted one after another land next to each other
+   on disk.  swap_lock must be held. */
+int find_swap_slot(void)
 {
-	int swap_idx = bitmap_scan(swap_bitmap,0,1,false);
+	size_t swap_idx;
 
-	if(swap_idx != BITMAP_ERROR)
-		return swap_idx;
-	else
+	ASSERT(lock_held_by_current_thread(&swap_lock));
+	swap_idx = bitmap_scan_and_flip(swap_bitmap,swap_cursor,1,false);
+	if(swap_idx == BITMAP_ERROR)
+		swap_idx = bitmap_scan_and_flip(swap_bitmap,0,1,false);
+	if(swap_idx == BITMAP_ERROR)
 		return -1;
+
+	swap_refs[swap_idx] = 1;
+	swap_cursor = swap_idx + 1;
+	if(swap_cursor >= bitmap_size(swap_bitmap))
+		swap_cursor = 0;
+	return swap_idx;
 }
 
+/* Writes the page at KADDR to a new swap slot and returns it, or
+   returns -1 if swap is full. */
 int swap_to_disk(void* kaddr){
 
 	ASSERT(kaddr >= PHYS_BASE);
-	struct block* b = block_get_role(BLOCK_SWAP);
+	lock_acquire(&swap_lock);
 	int swap_slot = find_swap_slot();
+	lock_release(&swap_lock);
 
 	if(swap_slot == -1){
 		return -1;
 	}
 
-	for(int i=0; i<8; i++){
-		block_write(b,swap_slot*8 + i,kaddr +(i*BLOCK_SECTOR_SIZE));
-	}
-	bitmap_set(swap_bitmap,swap_slot,true);
-	
+	block_write_multiple(swap_block,swap_slot*SECTORS_PER_SLOT,kaddr,
+			     SECTORS_PER_SLOT);
+	swap_out_cnt++;
 	return swap_slot;
 }
 
+/* Reads SWAP_SLOT into the page at KADDR and drops that page's
+   reference to the slot. */
 void swap_to_addr(int swap_slot,void * kaddr){
 	
-	struct block* b = block_get_role(BLOCK_SWAP);
+	block_read_multiple(swap_block,swap_slot*SECTORS_PER_SLOT,kaddr,
+			    SECTORS_PER_SLOT);
+	swap_in_cnt++;
+	swap_free(swap_slot);
+}
 
-	for(int i=0; i<8; i++)
-		block_read(b,swap_slot*8+i,kaddr+(i*BLOCK_SECTOR_SIZE));	
-	bitmap_set(swap_bitmap,swap_slot,false);
+/* Adds a reference to SWAP_SLOT, for another page that shares its
+   contents. */
+void swap_ref(int swap_slot){
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(swap_bitmap,swap_slot));
+	ASSERT(swap_refs[swap_slot] < UINT16_MAX);
+	swap_refs[swap_slot]++;
+	lock_release(&swap_lock);
 }
 
+/* Drops a reference to SWAP_SLOT, freeing it after the last. */
+void swap_free(int swap_slot){
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(swap_bitmap,swap_slot));
+	if(--swap_refs[swap_slot] == 0)
+		bitmap_reset(swap_bitmap,swap_slot);
+	lock_release(&swap_lock);
+}
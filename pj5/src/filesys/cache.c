@@ -1,128 +1,513 @@
 #include "filesys/cache.h"
+#include <round.h>
+#include <stdlib.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Number of cached sectors. */
+size_t buffer_cache_size = NUM_CACHE;
+
+/* Age of dirty sectors to write back in the background. */
+int64_t buffer_cache_flush_age = WRITE_BEHIND_AGE;
+
+/* Cache slots, and the pages backing their buffers.
+   Both are allocated from the kernel pool at boot. */
+static struct buffer_cache_entry *cache;
+static uint8_t *cache_buffers;
+static struct lock buffer_cache_lock;   /* Guards the clock hand and free slots. */
+
+/* Statistics. */
+static long long hit_cnt;               /* # of lookups that found the sector. */
+static long long miss_cnt;              /* # of lookups that had to load it. */
+static long long evict_cnt;             /* # of sectors evicted. */
+static long long writeback_cnt;         /* # of dirty sectors written back. */
+static long long wb_cnt;                /* # written back by write-behind. */
+static long long ra_queued_cnt;         /* # of read-ahead requests queued. */
+static long long ra_dropped_cnt;        /* # dropped because the queue was full. */
+static long long ra_load_cnt;           /* # of sectors loaded by read-ahead. */
+static long long ra_hit_cnt;            /* # of those later read or written. */
+static long long ra_waste_cnt;          /* # of those evicted unused. */
+
+/* Read-ahead requests, consumed by the read-ahead daemon. */
+#define RA_QUEUE_SIZE 256
+static block_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_cnt;          /* Oldest request, # of requests. */
+static struct lock ra_lock;             /* Guards the queue. */
+static struct condition ra_nonempty;    /* Signaled when a request arrives. */
+
+/* The sector index is split into shards, each with its own lock,
+   so that lookups of different sectors rarely contend.  A shard
+   lock only guards the index and the per-entry lock fields; the
+   512-byte copies and the disk I/O happen outside of it. */
+struct buffer_cache_shard {
+  struct lock lock;
+  struct hash index;              /* disk_sector -> buffer_cache_entry. */
+};
+static struct buffer_cache_shard shards[NUM_CACHE_SHARD];
+
+static struct buffer_cache_entry *buffer_cache_acquire (block_sector_t,
+                                                        bool exclusive,
+                                                        bool fill,
+                                                        bool prefetch);
+static void buffer_cache_unlock (struct buffer_cache_entry *, bool exclusive);
+static bool buffer_cache_evict (struct buffer_cache_entry *);
+static thread_func read_ahead_daemon NO_RETURN;
+static thread_func write_behind_daemon NO_RETURN;
+
+static unsigned
+buffer_cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct buffer_cache_entry *entry
+    = hash_entry (e, struct buffer_cache_entry, elem);
+  return hash_int (entry->disk_sector);
+}
+
+static bool
+buffer_cache_less (const struct hash_elem *a, const struct hash_elem *b,
+                   void *aux UNUSED)
+{
+  return hash_entry (a, struct buffer_cache_entry, elem)->disk_sector
+    < hash_entry (b, struct buffer_cache_entry, elem)->disk_sector;
+}
+
+static inline struct buffer_cache_shard *
+shard_of (block_sector_t sector)
+{
+  return &shards[sector % NUM_CACHE_SHARD];
+}
 
 void buffer_cache_init (void){
+  size_t meta_pages, data_pages;
+
+  if (buffer_cache_size == 0)
+    PANIC ("buffer cache must hold at least one sector");
+
+  // slot descriptors and sector buffers, from the kernel pool.
+  meta_pages = DIV_ROUND_UP (buffer_cache_size * sizeof *cache, PGSIZE);
+  data_pages = DIV_ROUND_UP (buffer_cache_size * BLOCK_SECTOR_SIZE, PGSIZE);
+  cache = palloc_get_multiple (PAL_ZERO, meta_pages);
+  cache_buffers = palloc_get_multiple (0, data_pages);
+  if (cache == NULL || cache_buffers == NULL)
+    PANIC ("buffer cache allocation failed--%zu sectors is too many",
+           buffer_cache_size);
+
   lock_init (&buffer_cache_lock);
 
   size_t i;
-  for (i = 0; i < NUM_CACHE; ++ i){
-    cache[i].valid_bit = false;
+  for (i = 0; i < NUM_CACHE_SHARD; ++ i){
+    lock_init (&shards[i].lock);
+    if (!hash_init (&shards[i].index, buffer_cache_hash, buffer_cache_less,
+                    NULL))
+      PANIC ("buffer cache index creation failed");
+  }
+  for (i = 0; i < buffer_cache_size; ++ i){
+    cache[i].state = CACHE_FREE;
+    cache[i].readers = 0;
+    cache[i].writer = false;
+    cond_init (&cache[i].unlocked);
+    cache[i].buffer = cache_buffers + i * BLOCK_SECTOR_SIZE;
   }
+
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  if (thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't start read-ahead daemon");
+  if (thread_create ("write-behind", PRI_DEFAULT, write_behind_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't start write-behind daemon");
 }
 
 void buffer_cache_terminate (void){
   lock_acquire (&buffer_cache_lock);
   just_in_case();
   size_t i;
-  for (i = 0; i < NUM_CACHE; ++ i){
-    if (cache[i].valid_bit == false) continue;
+  for (i = 0; i < buffer_cache_size; ++ i){
+    if (cache[i].state != CACHE_VALID) continue;
     buffer_cache_flush( &(cache[i]) );
   }
 
   lock_release (&buffer_cache_lock);
 }
 
-void buffer_cache_read (block_sector_t sector, void *target){
-  lock_acquire (&buffer_cache_lock);
-
-  struct buffer_cache_entry *slot = buffer_cache_lookup (sector);
-  if (slot == NULL) {
-    // cache miss: need select_victimion.
-    slot = buffer_cache_select_victim ();
-    ASSERT (slot != NULL && slot->valid_bit == false);
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void)
+{
+  printf ("Buffer cache: %zu sectors, %lld hits, %lld misses, "
+          "%lld evictions (%lld dirty), %lld written behind\n",
+          buffer_cache_size, hit_cnt, miss_cnt, evict_cnt, writeback_cnt,
+          wb_cnt);
+  printf ("Read-ahead: %lld requests (%lld dropped), %lld sectors loaded, "
+          "%lld used, %lld wasted\n",
+          ra_queued_cnt, ra_dropped_cnt, ra_load_cnt, ra_hit_cnt,
+          ra_waste_cnt);
+}
 
-    just_in_case();
-    // fill in the cache entry.
-    slot->valid_bit = true;
-    slot->disk_sector = sector;
-    slot->dirty = false;
-    just_in_case();
-    block_read (fs_device, sector, slot->buffer);
-  }
+void buffer_cache_read (block_sector_t sector, void *target){
+  struct buffer_cache_entry *slot = buffer_cache_acquire (sector, false, true, false);
 
   // copy the buffer data into memory.
-  slot->reference_bit = true;
   memcpy (target, slot->buffer, BLOCK_SECTOR_SIZE);
 
-  lock_release (&buffer_cache_lock);
+  buffer_cache_unlock (slot, false);
 }
 
 void buffer_cache_write (block_sector_t sector, const void *source){
-  lock_acquire (&buffer_cache_lock);
+  // a whole sector is overwritten, so a miss need not read the disk.
+  struct buffer_cache_entry *slot = buffer_cache_acquire (sector, true, false, false);
 
-  struct buffer_cache_entry *slot = buffer_cache_lookup (sector);
-  just_in_case();
-  if (slot == NULL) {
-    // cache miss: need select_victimion.
-    slot = buffer_cache_select_victim ();
-    ASSERT (slot != NULL && slot->valid_bit == false);
+  // copy the data form memory into the buffer cache.
+  memcpy (slot->buffer, source, BLOCK_SECTOR_SIZE);
 
-    // fill in the cache entry.
-    slot->valid_bit = true;
-    slot->disk_sector = sector;
-    slot->dirty = false;
-    just_in_case();
-    block_read (fs_device, sector, slot->buffer);
+  buffer_cache_unlock (slot, true);
+}
+
+/* Asks the read-ahead daemon to bring SECTOR into the cache,
+   without waiting for it.  The request is dropped if too many
+   are already pending. */
+void
+buffer_cache_prefetch (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_SIZE) {
+    ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE] = sector;
+    ra_queued_cnt++;
+    cond_signal (&ra_nonempty, &ra_lock);
   }
+  else
+    ra_dropped_cnt++;
+  lock_release (&ra_lock);
+}
 
-  // copy the data form memory into the buffer cache.
-  slot->reference_bit = true;
-  slot->dirty = true;
-  just_in_case();
-  memcpy (slot->buffer, source, BLOCK_SECTOR_SIZE);
+/* Loads queued read-ahead requests into the cache, one at a
+   time, skipping sectors that are already cached or in flight. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  while (true) {
+    block_sector_t sector;
+    struct buffer_cache_shard *shard;
+    struct buffer_cache_entry *slot;
+    bool cached;
 
-  lock_release (&buffer_cache_lock);
+    lock_acquire (&ra_lock);
+    while (ra_cnt == 0)
+      cond_wait (&ra_nonempty, &ra_lock);
+    sector = ra_queue[ra_head];
+    ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+    ra_cnt--;
+    lock_release (&ra_lock);
+
+    shard = shard_of (sector);
+    lock_acquire (&shard->lock);
+    cached = buffer_cache_lookup (sector) != NULL;
+    lock_release (&shard->lock);
+    if (cached)
+      continue;
+
+    slot = buffer_cache_acquire (sector, false, true, true);
+    buffer_cache_unlock (slot, false);
+  }
 }
 
-struct buffer_cache_entry* buffer_cache_lookup (block_sector_t sector){
-  size_t i;
-  for (i = 0; i < NUM_CACHE; ++ i){
-    if (cache[i].valid_bit == false) continue;
-    if (cache[i].disk_sector == sector) { // cache hit
-      just_in_case();
-      return &(cache[i]); 
+/* Orders cache entries by disk sector, for qsort(). */
+static int
+compare_entry_sector (const void *a_, const void *b_)
+{
+  const struct buffer_cache_entry *a = *(struct buffer_cache_entry **) a_;
+  const struct buffer_cache_entry *b = *(struct buffer_cache_entry **) b_;
+  return a->disk_sector < b->disk_sector ? -1 : a->disk_sector > b->disk_sector;
+}
+
+/* Writes back up to WRITE_BEHIND_BATCH sectors that have been
+   dirty for at least buffer_cache_flush_age ticks, in sector
+   order.  Returns the number of sectors written. */
+static size_t
+write_behind (void)
+{
+  struct buffer_cache_entry *batch[WRITE_BEHIND_BATCH];
+  int64_t now = timer_ticks ();
+  size_t cnt = 0, i;
+
+  // pick old dirty entries, pinning them as readers: that keeps
+  // writers out and the clock away while they're written back.
+  lock_acquire (&buffer_cache_lock);
+  for (i = 0; i < buffer_cache_size && cnt < WRITE_BEHIND_BATCH; ++ i){
+    struct buffer_cache_entry *entry = &cache[i];
+    struct buffer_cache_shard *shard;
+
+    if (entry->state != CACHE_VALID) continue;
+    shard = shard_of (entry->disk_sector);
+    lock_acquire (&shard->lock);
+    if (entry->dirty && !entry->writer
+        && now - entry->dirty_since >= buffer_cache_flush_age) {
+      entry->readers++;
+      batch[cnt++] = entry;
     }
+    lock_release (&shard->lock);
+  }
+  lock_release (&buffer_cache_lock);
+
+  qsort (batch, cnt, sizeof *batch, compare_entry_sector);
+  for (i = 0; i < cnt; ++ i){
+    struct buffer_cache_entry *entry = batch[i];
+    struct buffer_cache_shard *shard = shard_of (entry->disk_sector);
+
+    block_write (fs_device, entry->disk_sector, entry->buffer);
+
+    lock_acquire (&shard->lock);
+    entry->dirty = false;
+    entry->readers--;
+    if (entry->readers == 0)
+      cond_broadcast (&entry->unlocked, &shard->lock);
+    lock_release (&shard->lock);
+    wb_cnt++;
   }
-  return NULL; // cache miss
+  return cnt;
 }
 
-struct buffer_cache_entry* buffer_cache_select_victim (void){
-  ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
+/* Periodically writes back old dirty sectors, so that the clock
+   mostly finds clean victims and a crash loses less data. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  int64_t period = buffer_cache_flush_age / 2;
 
-  static size_t clock = 0;
-  just_in_case();
+  if (period < 1)
+    period = 1;
+  while (true) {
+    timer_sleep (period);
+    // keep going while there's a full batch of old sectors
+    while (write_behind () == WRITE_BEHIND_BATCH)
+      continue;
+  }
+}
+
+/* Returns the entry caching SECTOR, or a null pointer.
+   The caller must hold the lock of SECTOR's shard. */
+struct buffer_cache_entry* buffer_cache_lookup (block_sector_t sector){
+  struct buffer_cache_shard *shard = shard_of (sector);
+  struct buffer_cache_entry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&shard->lock));
+
+  key.disk_sector = sector;
+  e = hash_find (&shard->index, &key.elem);
+  if (e == NULL)
+    return NULL; // cache miss
+  return hash_entry (e, struct buffer_cache_entry, elem); // cache hit
+}
+
+/* Returns the entry for SECTOR locked for reading, or for
+   writing if EXCLUSIVE, loading it first on a miss.  The sector
+   is only read from disk on a miss if FILL is true.  PREFETCH
+   marks a load by the read-ahead daemon, which is counted apart
+   from demand hits and misses.
+   Release the entry with buffer_cache_unlock(). */
+static struct buffer_cache_entry *
+buffer_cache_acquire (block_sector_t sector, bool exclusive, bool fill,
+                      bool prefetch)
+{
+  struct buffer_cache_shard *shard = shard_of (sector);
+  struct buffer_cache_entry *slot, *fresh = NULL;
+
+  lock_acquire (&shard->lock);
   while (true) {
-    if (cache[clock].valid_bit == false) { // found an empty slot -- use it
-      return &(cache[clock]);
+    slot = buffer_cache_lookup (sector);
+    if (slot == NULL) {
+      if (fresh != NULL)
+        break;
+
+      // cache miss: take a slot from the clock without holding the
+      // shard lock, then look again in case somebody beat us to it.
+      lock_release (&shard->lock);
+      fresh = buffer_cache_select_victim ();
+      lock_acquire (&shard->lock);
+      continue;
     }
 
-    if (cache[clock].reference_bit) {  // give a second chance
-      cache[clock].reference_bit = false;
+    if (fresh != NULL) {
+      // lost the race: hand the spare slot back to the clock.
+      lock_release (&shard->lock);
+      lock_acquire (&buffer_cache_lock);
+      fresh->state = CACHE_FREE;
+      lock_release (&buffer_cache_lock);
+      fresh = NULL;
+      lock_acquire (&shard->lock);
+      continue;
     }
-    else break;
 
-    clock ++;
-    clock %= NUM_CACHE;
+    if (slot->writer || (exclusive && slot->readers > 0)) {
+      // in flight or in use: wait, then retry since the slot may
+      // have been evicted in the meantime.
+      cond_wait (&slot->unlocked, &shard->lock);
+      continue;
+    }
+    break;
+  }
+
+  if (slot == NULL) {
+    // fill in the cache entry, keeping others out until it's valid.
+    if (prefetch)
+      ra_load_cnt++;
+    else
+      miss_cnt++;
+    slot = fresh;
+    slot->disk_sector = sector;
+    slot->dirty = false;
+    slot->prefetched = prefetch;
+    slot->writer = true;
+    hash_insert (&shard->index, &slot->elem);
+
+    if (fill) {
+      lock_release (&shard->lock);
+      block_read (fs_device, sector, slot->buffer);
+      lock_acquire (&shard->lock);
+    }
+    slot->state = CACHE_VALID;
+    if (!exclusive) {
+      slot->writer = false;
+      slot->readers++;
+      cond_broadcast (&slot->unlocked, &shard->lock);
+    }
+  }
+  else if (prefetch)
+    slot->readers++;
+  else {
+    hit_cnt++;
+    if (slot->prefetched) {
+      slot->prefetched = false;
+      ra_hit_cnt++;
+    }
+    if (exclusive)
+      slot->writer = true;
+    else
+      slot->readers++;
+  }
+
+  slot->reference_bit = true;
+  lock_release (&shard->lock);
+  return slot;
+}
+
+/* Drops the lock taken on SLOT by buffer_cache_acquire(),
+   marking it dirty if it was locked EXCLUSIVE. */
+static void
+buffer_cache_unlock (struct buffer_cache_entry *slot, bool exclusive)
+{
+  struct buffer_cache_shard *shard = shard_of (slot->disk_sector);
+
+  lock_acquire (&shard->lock);
+  if (exclusive) {
+    ASSERT (slot->writer);
+    slot->writer = false;
+    if (!slot->dirty) {
+      slot->dirty = true;
+      slot->dirty_since = timer_ticks ();
+    }
   }
+  else {
+    ASSERT (slot->readers > 0);
+    slot->readers--;
+  }
+  if (!slot->writer && slot->readers == 0)
+    cond_broadcast (&slot->unlocked, &shard->lock);
+  lock_release (&shard->lock);
+}
+
+/* Picks a slot with the clock algorithm, writing back and
+   evicting its old contents if necessary.  Returns the slot in
+   CACHE_LOADING state, outside of any shard index. */
+struct buffer_cache_entry* buffer_cache_select_victim (void){
+  static size_t clock = 0;
+  struct buffer_cache_entry *slot;
+
+  lock_acquire (&buffer_cache_lock);
+  while (true) {
+    slot = &cache[clock];
+    clock ++;
+    clock %= buffer_cache_size;
 
-  // select_victim cache[clock]
-  struct buffer_cache_entry *slot = &cache[clock];
-  if (slot->dirty) {  // write back into disk
-    just_in_case();
-    buffer_cache_flush (slot);
+    if (slot->state == CACHE_FREE) // found an empty slot -- use it
+      break;
+    if (slot->state == CACHE_VALID && buffer_cache_evict (slot))
+      break;
   }
 
-  slot->valid_bit = false;
+  slot->state = CACHE_LOADING;
+  lock_release (&buffer_cache_lock);
   return slot;
 }
 
+/* Evicts SLOT unless it is in use or deserves a second chance.
+   Returns true if SLOT is now free.
+
+   A dirty SLOT is written back with buffer_cache_lock released,
+   so that other misses need not wait for the disk.  Meanwhile
+   SLOT is CACHE_LOADING, which keeps the clock, write-behind and
+   other evictors away from it, and its writer flag keeps out
+   threads that look up its sector. */
+static bool
+buffer_cache_evict (struct buffer_cache_entry *slot)
+{
+  struct buffer_cache_shard *shard = shard_of (slot->disk_sector);
+  bool evicted = false;
+
+  ASSERT (lock_held_by_current_thread (&buffer_cache_lock));
+
+  lock_acquire (&shard->lock);
+  if (slot->writer || slot->readers > 0)
+    ; // in use -- skip
+  else if (slot->reference_bit)  // give a second chance
+    slot->reference_bit = false;
+  else {
+    if (slot->dirty) {  // write back into disk, holding off readers
+      slot->writer = true;
+      slot->state = CACHE_LOADING;
+      lock_release (&shard->lock);
+      lock_release (&buffer_cache_lock);
+      block_write (fs_device, slot->disk_sector, slot->buffer);
+      lock_acquire (&buffer_cache_lock);
+      lock_acquire (&shard->lock);
+      slot->writer = false;
+      slot->dirty = false;
+      writeback_cnt++;
+    }
+    evict_cnt++;
+    if (slot->prefetched)
+      ra_waste_cnt++;
+    hash_delete (&shard->index, &slot->elem);
+    slot->state = CACHE_FREE;
+    cond_broadcast (&slot->unlocked, &shard->lock);
+    evicted = true;
+  }
+  lock_release (&shard->lock);
+  return evicted;
+}
+
 void buffer_cache_flush (struct buffer_cache_entry *entry)
 {
   ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
-  ASSERT (entry != NULL && entry->valid_bit == true);
+  ASSERT (entry != NULL && entry->state == CACHE_VALID);
+
+  struct buffer_cache_shard *shard = shard_of (entry->disk_sector);
+  lock_acquire (&shard->lock);
+  while (entry->writer)
+    cond_wait (&entry->unlocked, &shard->lock);
 
   if (entry->dirty) {
-    just_in_case();
+    // write back as a reader, so that nobody modifies it meanwhile.
+    entry->readers++;
+    lock_release (&shard->lock);
     block_write (fs_device, entry->disk_sector, entry->buffer);
+    lock_acquire (&shard->lock);
+    entry->readers--;
     entry->dirty = false;
+    if (entry->readers == 0)
+      cond_broadcast (&entry->unlocked, &shard->lock);
   }
-}
\ No newline at end of file
+  lock_release (&shard->lock);
+}
@@ -4,29 +4,68 @@
 #include <stdio.h>
 #include <string.h>
 #include <debug.h>
+#include <hash.h>
 #include "filesys/filesys.h"
 #include "threads/synch.h"
 #include "devices/block.h"
 #include "threads/thread.h"
 
+/* States of a buffer cache slot. */
+enum buffer_cache_state
+  {
+    CACHE_FREE,         /* Unused, owned by the clock. */
+    CACHE_LOADING,      /* Claimed for a sector, contents not valid yet. */
+    CACHE_VALID         /* Holds the contents of disk_sector. */
+  };
+
 struct buffer_cache_entry {
-  bool valid_bit;
+  enum buffer_cache_state state;
   bool reference_bit;
-  bool dirty;     
+  bool dirty;
+  bool prefetched;                /* Loaded by read-ahead, not used yet. */
+  int64_t dirty_since;            /* Timer tick at which it became dirty. */
 
   block_sector_t disk_sector;
-  uint8_t buffer[BLOCK_SECTOR_SIZE]; // 512 * 1B
+  struct hash_elem elem;          /* Element in the shard's sector index. */
+
+  // per-entry reader/writer lock, guarded by the shard lock.
+  int readers;                    /* # of threads copying out of buffer. */
+  bool writer;                    /* Buffer is being loaded or modified. */
+  struct condition unlocked;      /* Signaled when readers/writer drop. */
+
+  uint8_t *buffer;                /* BLOCK_SECTOR_SIZE bytes of data. */
 };
+
+/* Default number of cached sectors (32 kB). */
 #define NUM_CACHE 64
-static struct buffer_cache_entry cache[NUM_CACHE];
-static struct lock buffer_cache_lock;
+#define NUM_CACHE_SHARD 8
+
+/* Bounds of the per-inode read-ahead window, in sectors. */
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 64
+
+/* Default age, in timer ticks, after which the write-behind
+   daemon writes a dirty sector back, and the most sectors it
+   writes back per pass. */
+#define WRITE_BEHIND_AGE 100
+#define WRITE_BEHIND_BATCH 32
+
+/* Number of cached sectors.
+   Controlled by kernel command-line option "-cache=SECTORS". */
+extern size_t buffer_cache_size;
+
+/* Age of dirty sectors to write back in the background.
+   Controlled by kernel command-line option "-cache-age=TICKS". */
+extern int64_t buffer_cache_flush_age;
 
 void buffer_cache_init (void);
 void buffer_cache_terminate (void);
+void buffer_cache_print_stats (void);
 void buffer_cache_read (block_sector_t sector, void *target);
 void buffer_cache_write (block_sector_t sector, const void *source);
+void buffer_cache_prefetch (block_sector_t sector);
 struct buffer_cache_entry *buffer_cache_lookup (block_sector_t);
 struct buffer_cache_entry *buffer_cache_select_victim (void);
 void buffer_cache_flush(struct buffer_cache_entry*);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,215 @@
+#include "filesys/dcache.h"
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* What a lookup of NAME in the directory whose inode is at DIR
+   found: the inode sector of the entry, or DCACHE_NEGATIVE if
+   there was none. */
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru, newest first. */
+    block_sector_t dir;                 /* Sector of directory's inode. */
+    block_sector_t sector;              /* Sector of entry's inode. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+static struct hash dentries;            /* (dir, name) -> dentry. */
+static struct list lru;                 /* All dentries, most recent first. */
+static struct lock dcache_lock;         /* Guards the above. */
+
+/* Change counts of directories, by hash of the directory's sector.
+   An answer read from a directory is cached only if the count did
+   not change while it was read, so a lookup that raced with
+   dir_add() or dir_remove() cannot cache what it saw before. */
+#define GENERATION_CNT 64
+static unsigned generations[GENERATION_CNT];
+
+/* Statistics. */
+static long long hit_cnt;               /* # of lookups answered. */
+static long long negative_cnt;          /* # of those that were negative. */
+static long long miss_cnt;              /* # of lookups not answered. */
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the dentry for NAME in DIR, or a null pointer.
+   dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Returns the change count for DIR.  dcache_lock must be held. */
+static unsigned *
+generation (block_sector_t dir)
+{
+  return &generations[hash_int (dir) % GENERATION_CNT];
+}
+
+/* Forgets dentry D.  dcache_lock must be held. */
+static void
+forget (struct dentry *d)
+{
+  hash_delete (&dentries, &d->elem);
+  list_remove (&d->lru_elem);
+  free (d);
+}
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %lld hits (%lld negative), %lld misses\n",
+          hit_cnt, negative_cnt, miss_cnt);
+}
+
+/* Looks up NAME in the directory whose inode is at DIR.
+   If the answer is known, returns true and sets *SECTOR to the
+   sector of the entry's inode, or to DCACHE_NEGATIVE if DIR has
+   no such entry.  Otherwise, returns false.  Either way, sets
+   *GEN to DIR's change count, to be passed to dcache_insert()
+   with the answer read from DIR. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sector,
+               unsigned *gen)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  *gen = *generation (dir);
+  if (strlen (name) > NAME_MAX)
+    {
+      lock_release (&dcache_lock);
+      return false;
+    }
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      *sector = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+      hit_cnt++;
+      if (d->sector == DCACHE_NEGATIVE)
+        negative_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is at DIR is the
+   inode at SECTOR, or that there is no such entry if SECTOR is
+   DCACHE_NEGATIVE.  Does nothing if DIR changed since
+   dcache_lookup() returned GEN, since the answer may be stale.
+   Forgets the least recently used answer if the cache is full. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector,
+               unsigned gen)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  if (*generation (dir) != gen)
+    {
+      lock_release (&dcache_lock);
+      return;
+    }
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        forget (list_entry (list_back (&lru), struct dentry, lru_elem));
+      d = malloc (sizeof *d);
+      if (d != NULL)
+        {
+          d->dir = dir;
+          strlcpy (d->name, name, sizeof d->name);
+          hash_insert (&dentries, &d->elem);
+          list_push_front (&lru, &d->lru_elem);
+        }
+    }
+  if (d != NULL)
+    d->sector = sector;
+  lock_release (&dcache_lock);
+}
+
+/* Forgets what is known about NAME in the directory whose inode
+   is at DIR.  Must be called whenever that entry changes, after
+   the change is written, so that lookups in flight see it. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  ++ *generation (dir);
+  d = find (dir, name);
+  if (d != NULL)
+    forget (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets everything known about names in the directory whose
+   inode is at DIR, which is being removed, so that a directory
+   that later reuses its sector does not inherit them. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  ++ *generation (dir);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        forget (d);
+    }
+  lock_release (&dcache_lock);
+}
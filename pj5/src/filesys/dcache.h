@@ -0,0 +1,22 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Most (directory, name) pairs remembered at once. */
+#define DCACHE_SIZE 256
+
+/* Child sector of a name known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1)
+
+void dcache_init (void);
+void dcache_print_stats (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sector, unsigned *gen);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector, unsigned gen);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_invalidate_dir (block_sector_t dir);
+
+#endif /* filesys/dcache.h */
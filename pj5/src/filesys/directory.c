@@ -3,7 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
@@ -23,6 +26,45 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* The first slot of a directory, in place of an entry.
+   PARENT_SECTOR lines up with an entry's INODE_SECTOR, which is
+   how ".." is found. */
+struct dir_header
+  {
+    block_sector_t parent_sector;       /* Sector of parent's header. */
+    block_sector_t index_sector;        /* Name index, if INDEX_MAGIC. */
+    unsigned index_magic;               /* DIR_INDEX_MAGIC if indexed. */
+    uint8_t unused[sizeof (struct dir_entry) - 12];
+  };
+
+/* Name index of a large directory, kept in a file of its own.
+   It is an open-addressed hash table keyed by hash_string() of
+   the name, followed on disk by BUCKET_CNT buckets, each of which
+   is DIR_INDEX_EMPTY, DIR_INDEX_DEAD or the number of the slot
+   that holds the entry.  Unused slots are chained through their
+   INODE_SECTOR fields, starting at FREE_SLOT, so adding an entry
+   does not have to search for room either. */
+struct dir_index
+  {
+    uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+    uint32_t live_cnt;                  /* Buckets that name a slot. */
+    uint32_t dead_cnt;                  /* Buckets set to DIR_INDEX_DEAD. */
+    uint32_t free_slot;                 /* First unused slot, or 0. */
+  };
+
+#define DIR_INDEX_MAGIC 0x44495831      /* "DIX1". */
+#define DIR_INDEX_EMPTY 0               /* Bucket never used. */
+#define DIR_INDEX_DEAD ((uint32_t) -1)  /* Bucket of a removed entry. */
+
+/* A directory gets a name index once it has this many slots. */
+#define DIR_INDEX_THRESHOLD 32
+
+/* Fewest buckets in a name index. */
+#define DIR_INDEX_MIN_BUCKETS 64
+
+static bool index_build (struct dir *);
+static void index_drop (struct dir *);
+
 /* Creates a directory with space for ENTRY_CNT entries in the given SECTOR.
    Returns true if successful, false on failure. */
 bool
@@ -33,9 +75,10 @@ dir_create (block_sector_t sector, size_t entry_cnt)
   if(!success) return false;
   just_in_case();
   struct dir *dir = dir_open( inode_open(sector) );
-  struct dir_entry e;
-  e.inode_sector = sector;
-  if (inode_write_at(dir->inode, &e, sizeof e, 0) != sizeof e) {
+  struct dir_header h;
+  memset (&h, 0, sizeof h);
+  h.parent_sector = sector;
+  if (inode_write_at(dir->inode, &h, sizeof h, 0) != sizeof h) {
     success = false;
   }
   dir_close (dir);
@@ -150,6 +193,198 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the byte offset of bucket B in a name index. */
+static inline off_t
+bucket_ofs (uint32_t b)
+{
+  return sizeof (struct dir_index) + b * sizeof (uint32_t);
+}
+
+/* If DIR has a name index, opens it, reads its header into *IX
+   and returns it.  Otherwise, returns a null pointer. */
+static struct inode *
+index_open (const struct dir *dir, struct dir_index *ix)
+{
+  struct dir_header h;
+  struct inode *index;
+
+  if (inode_read_at (dir->inode, &h, sizeof h, 0) != sizeof h
+      || h.index_magic != DIR_INDEX_MAGIC)
+    return NULL;
+  index = inode_open (h.index_sector);
+  if (index != NULL
+      && inode_read_at (index, ix, sizeof *ix, 0) != sizeof *ix)
+    {
+      inode_close (index);
+      index = NULL;
+    }
+  return index;
+}
+
+/* Looks up NAME in INDEX, the name index of DIR with header IX.
+   If found, returns true, stores the entry in *EP and its offset
+   in *OFSP if they are non-null, and its bucket in *BUCKETP.
+   Otherwise, returns false and stores in *BUCKETP the bucket
+   where NAME would be added. */
+static bool
+index_find (struct inode *index, const struct dir_index *ix,
+            const struct dir *dir, const char *name,
+            struct dir_entry *ep, off_t *ofsp, uint32_t *bucketp)
+{
+  uint32_t mask = ix->bucket_cnt - 1;
+  uint32_t b = hash_string (name) & mask;
+  uint32_t reuse = DIR_INDEX_DEAD;
+  uint32_t i;
+
+  /* Buckets are never more than half used, so there is always
+     an empty one to stop at. */
+  for (i = 0; i < ix->bucket_cnt; ++ i, b = (b + 1) & mask)
+    {
+      struct dir_entry e;
+      uint32_t slot;
+
+      if (inode_read_at (index, &slot, sizeof slot, bucket_ofs (b))
+          != sizeof slot)
+        break;
+      if (slot == DIR_INDEX_EMPTY)
+        {
+          *bucketp = reuse != DIR_INDEX_DEAD ? reuse : b;
+          return false;
+        }
+      if (slot == DIR_INDEX_DEAD)
+        {
+          if (reuse == DIR_INDEX_DEAD)
+            reuse = b;
+          continue;
+        }
+      if (inode_read_at (dir->inode, &e, sizeof e, slot * sizeof e)
+          == sizeof e
+          && e.in_use && !strcmp (name, e.name))
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (ofsp != NULL)
+            *ofsp = slot * sizeof e;
+          *bucketp = b;
+          return true;
+        }
+    }
+  *bucketp = reuse;
+  return false;
+}
+
+/* Stores SLOT in bucket B of INDEX. */
+static bool
+index_set (struct inode *index, uint32_t b, uint32_t slot)
+{
+  return inode_write_at (index, &slot, sizeof slot, bucket_ofs (b))
+         == sizeof slot;
+}
+
+/* (Re)builds the name index of DIR from its entries, sized for
+   twice as many entries as it has now, and threads its unused
+   slots onto the free list.  Replaces any previous index.
+   Returns true if successful.  On failure DIR keeps working, by
+   linear search if it has no index. */
+static bool
+index_build (struct dir *dir)
+{
+  struct dir_header h;
+  struct dir_entry e;
+  struct dir_index *ix;
+  uint32_t *buckets;
+  uint32_t bucket_cnt, slot, live_cnt;
+  block_sector_t sector = 0;
+  struct inode *index = NULL;
+  off_t size;
+  bool success = false;
+
+  if (inode_read_at (dir->inode, &h, sizeof h, 0) != sizeof h)
+    return false;
+
+  live_cnt = 0;
+  for (slot = 1; inode_read_at (dir->inode, &e, sizeof e, slot * sizeof e)
+                 == sizeof e; ++ slot)
+    if (e.in_use)
+      ++ live_cnt;
+
+  bucket_cnt = DIR_INDEX_MIN_BUCKETS;
+  while (bucket_cnt < live_cnt * 4)
+    bucket_cnt *= 2;
+  size = bucket_ofs (bucket_cnt);
+  ix = calloc (1, size);
+  if (ix == NULL)
+    return false;
+  ix->bucket_cnt = bucket_cnt;
+  buckets = (uint32_t *) (ix + 1);
+
+  for (slot = 1; inode_read_at (dir->inode, &e, sizeof e, slot * sizeof e)
+                 == sizeof e; ++ slot)
+    if (e.in_use)
+      {
+        uint32_t b = hash_string (e.name) & (bucket_cnt - 1);
+        while (buckets[b] != DIR_INDEX_EMPTY)
+          b = (b + 1) & (bucket_cnt - 1);
+        buckets[b] = slot;
+        ++ ix->live_cnt;
+      }
+    else
+      {
+        e.inode_sector = ix->free_slot;
+        if (inode_write_at (dir->inode, &e, sizeof e, slot * sizeof e)
+            != sizeof e)
+          goto done;
+        ix->free_slot = slot;
+      }
+
+  if (!free_map_allocate (1, &sector))
+    goto done;
+  if (!inode_create (sector, 0, false)
+      || (index = inode_open (sector)) == NULL)
+    {
+      free_map_release (sector, 1);
+      goto done;
+    }
+  if (inode_write_at (index, ix, size, 0) != size)
+    {
+      inode_remove (index);
+      goto done;
+    }
+
+  index_drop (dir);
+  h.index_sector = sector;
+  h.index_magic = DIR_INDEX_MAGIC;
+  success = inode_write_at (dir->inode, &h, sizeof h, 0) == sizeof h;
+  if (!success)
+    inode_remove (index);
+
+ done:
+  inode_close (index);
+  free (ix);
+  return success;
+}
+
+/* Frees the name index of DIR, if any, leaving DIR to be
+   searched linearly. */
+static void
+index_drop (struct dir *dir)
+{
+  struct dir_header h;
+
+  if (inode_read_at (dir->inode, &h, sizeof h, 0) == sizeof h
+      && h.index_magic == DIR_INDEX_MAGIC)
+    {
+      struct inode *index = inode_open (h.index_sector);
+      if (index != NULL)
+        {
+          inode_remove (index);
+          inode_close (index);
+        }
+      h.index_magic = 0;
+      inode_write_at (dir->inode, &h, sizeof h, 0);
+    }
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -160,11 +395,22 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
   struct dir_entry e;
+  struct dir_index ix;
+  struct inode *index;
   size_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = index_open (dir, &ix);
+  if (index != NULL)
+    {
+      uint32_t b;
+      bool found = index_find (index, &ix, dir, name, ep, ofsp, &b);
+      inode_close (index);
+      return found;
+    }
+
   for (ofs = sizeof e; /* 0-pos is for parent directory */
        inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e)
@@ -208,23 +454,35 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
   struct dir_entry e;
+  block_sector_t dir_sector, sector;
+  unsigned gen;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (strcmp (name, "..") == 0) {
-    inode_read_at (dir->inode, &e, sizeof e, 0);
-    *inode = inode_open (e.inode_sector);
-  }
-  else if (strcmp (name, ".") == 0) {
+  if (strcmp (name, ".") == 0) {
     *inode = inode_reopen (dir->inode);
+    return *inode != NULL;
   }
-  else if (lookup (dir, name, &e, NULL)) {
-    *inode = inode_open (e.inode_sector);
+
+  // ask the dentry cache first, and tell it what the directory says
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector, &gen)) {
+    if (strcmp (name, "..") == 0) {
+      inode_read_at (dir->inode, &e, sizeof e, 0);
+      sector = e.inode_sector;
+    }
+    else if (lookup (dir, name, &e, NULL))
+      sector = e.inode_sector;
+    else
+      sector = DCACHE_NEGATIVE;
+    // a removed directory's sector may be reused by another one;
+    // the insert is dropped if dir_add/dir_remove ran meanwhile
+    if (!inode_is_removed (dir->inode))
+      dcache_insert (dir_sector, name, sector, gen);
   }
-  else
-    *inode = NULL;
 
+  *inode = sector != DCACHE_NEGATIVE ? inode_open (sector) : NULL;
   return *inode != NULL;
 }
 
@@ -239,6 +497,9 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is_dir)
 {
   struct dir_entry e;
+  struct dir_index ix;
+  struct inode *index;
+  uint32_t bucket = 0;
   off_t ofs;
   bool success = false;
 
@@ -250,19 +511,25 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  index = index_open (dir, &ix);
+  if (index != NULL
+      ? index_find (index, &ix, dir, name, NULL, NULL, &bucket)
+      : lookup (dir, name, NULL, NULL))
     goto done;
+  if (index != NULL && bucket == DIR_INDEX_DEAD)
+    goto done;  // index unreadable
 
   // update the child directory [inode_sector] has a parent directory [dir]
   if (is_dir)
   {
     just_in_case();
-    /* e is a parent-directory-entry here */
+    /* only the parent field of the child's header changes */
     struct dir *child_dir = dir_open( inode_open(inode_sector) );
     if(child_dir == NULL) goto done;
-    e.inode_sector = inode_get_inumber( dir_get_inode(dir) );
+    block_sector_t parent = inode_get_inumber( dir_get_inode(dir) );
     just_in_case();
-    if (inode_write_at(child_dir->inode, &e, sizeof e, 0) != sizeof e) {
+    if (inode_write_at(child_dir->inode, &parent, sizeof parent, 0)
+        != sizeof parent) {
       dir_close (child_dir);
       goto done;
     }
@@ -275,19 +542,59 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
 
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+     read due to something intermittent such as low memory.
+     An indexed directory keeps its free slots on a list instead. */
+  if (index != NULL && ix.free_slot != 0)
+    {
+      ofs = ix.free_slot * sizeof e;
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        goto done;
+      ix.free_slot = e.inode_sector;
+    }
+  else if (index != NULL)
+    ofs = inode_length (dir->inode);
+  else
+    for (ofs = sizeof e; /* 0-pos is for parent directory */
+         inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+         ofs += sizeof e)
+      if (!e.in_use)
+        break;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!success)
+    goto done;
+
+  if (index != NULL)
+    {
+      uint32_t old;
+      if (inode_read_at (index, &old, sizeof old, bucket_ofs (bucket))
+          != sizeof old
+          || !index_set (index, bucket, ofs / sizeof e))
+        {
+          success = false;
+          goto done;
+        }
+      if (old == DIR_INDEX_DEAD)
+        -- ix.dead_cnt;
+      ++ ix.live_cnt;
+      inode_write_at (index, &ix, sizeof ix, 0);
+
+      // keep the table at most half full
+      if ((ix.live_cnt + ix.dead_cnt) * 2 > ix.bucket_cnt)
+        index_build (dir);
+    }
+  else if (ofs / (off_t) sizeof e >= DIR_INDEX_THRESHOLD)
+    index_build (dir);
 
  done:
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (success && is_dir)
+    dcache_invalidate (inode_sector, "..");
+  inode_close (index);
   return success;
 }
 
@@ -298,7 +605,10 @@ bool
 dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
+  struct dir_index ix;
+  struct inode *index;
   struct inode *inode = NULL;
+  uint32_t bucket = 0;
   bool success = false;
   off_t ofs;
 
@@ -306,7 +616,10 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  index = index_open (dir, &ix);
+  if (index != NULL
+      ? !index_find (index, &ix, dir, name, &e, &ofs, &bucket)
+      : !lookup (dir, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
@@ -317,22 +630,37 @@ dir_remove (struct dir *dir, const char *name)
   /* Prevent removing non-empty directory. */
   if (inode_is_directory (inode)) {
     // target : the directory to be removed. (dir : the base directory)
-    struct dir *target = dir_open (inode);
-    bool is_empty = dir_is_empty (target);
+    struct dir *target = dir_open (inode_reopen (inode));
+    bool is_empty = target != NULL && dir_is_empty (target);
+    if (is_empty)
+      index_drop (target);
     dir_close (target);
     if (! is_empty) goto done; // can't delete
   }
 
   /* Erase directory entry. */
   e.in_use = false;
+  if (index != NULL)
+    e.inode_sector = ix.free_slot;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  if (index != NULL && index_set (index, bucket, DIR_INDEX_DEAD))
+    {
+      ix.free_slot = ofs / sizeof e;
+      -- ix.live_cnt;
+      ++ ix.dead_cnt;
+      inode_write_at (index, &ix, sizeof ix, 0);
+    }
 
   /* Remove inode. */
+  if (inode_is_directory (inode))
+    dcache_invalidate_dir (inode_get_inumber (inode));
   inode_remove (inode);
   success = true;
 
  done:
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  inode_close (index);
   inode_close (inode);
   return success;
 }
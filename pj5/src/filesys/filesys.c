@@ -8,6 +8,7 @@
 #include "filesys/directory.h"
 
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "threads/thread.h"
 
 /* Partition that contains the file system. */
@@ -31,9 +32,12 @@ filesys_init (bool format)
   free_map_init ();
 
   buffer_cache_init ();
+  dcache_init ();
 
   if (format)
     do_format ();
+  else
+    inode_adopt_layout (FREE_MAP_SECTOR);
 
   free_map_open ();
 }
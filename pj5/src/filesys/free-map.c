@@ -1,13 +1,28 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Number of free map bits stored in one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file that differ from memory, one bit
+   per sector of the file.  Only these are written back, so an
+   allocation costs one sector write instead of the whole map. */
+static struct bitmap *free_map_dirty;
+static int batch_depth;              /* Nesting of open batches. */
+static struct lock free_map_lock;    /* Guards all of the above. */
+
+static void mark_dirty (block_sector_t, size_t);
+static bool persist (void);
+
 /* Initializes the free map. */
 void
 free_map_init (void)
@@ -17,6 +32,38 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                                BITS_PER_SECTOR));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  batch_depth = 0;
+  lock_init (&free_map_lock);
+}
+
+/* Starts a batch of free map updates.  Until the matching
+   free_map_end_batch(), changes are kept in memory only and then
+   written together, so that extending a file by many sectors
+   writes each touched sector of the free map once.  Batches may
+   nest. */
+void
+free_map_begin_batch (void)
+{
+  lock_acquire (&free_map_lock);
+  ++ batch_depth;
+  lock_release (&free_map_lock);
+}
+
+/* Ends a batch started by free_map_begin_batch(), writing the
+   changed sectors of the free map if it is the outermost. */
+void
+free_map_end_batch (void)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (batch_depth > 0);
+  if (-- batch_depth == 0)
+    persist ();
+  lock_release (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +74,102 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      mark_dirty (sector, cnt);
+      if (!persist ())
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false);
+          sector = BITMAP_ERROR;
+        }
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT consecutive sectors starting at SECTOR, if
+   they are all free.
+   Returns true if successful, false if any of them is in use,
+   past the end of the device, or if the free_map file could not
+   be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (sector < bitmap_size (free_map)
+      && cnt <= bitmap_size (free_map) - sector
+      && bitmap_none (free_map, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
+      success = persist ();
+      if (!success)
+        bitmap_set_multiple (free_map, sector, cnt, false);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  persist ();
+  lock_release (&free_map_lock);
+}
+
+/* Records that the free map sectors holding the CNT bits starting
+   at SECTOR no longer match the free map file. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Writes the dirty sectors of the free map to its file, unless a
+   batch is open or the file is not open yet, in which case the
+   write is left for later.  Returns false if a write failed; the
+   sectors involved stay dirty.  free_map_lock must be held. */
+static bool
+persist (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+  bool success = true;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  if (free_map_file == NULL || batch_depth > 0)
+    return true;
+
+  for (i = bitmap_scan (free_map_dirty, 0, 1, true); i != BITMAP_ERROR;
+       i = bitmap_scan (free_map_dirty, i + 1, 1, true))
+    {
+      size_t start = i * BITS_PER_SECTOR;
+      size_t cnt = bit_cnt - start < BITS_PER_SECTOR
+                   ? bit_cnt - start : BITS_PER_SECTOR;
+
+      if (bitmap_write_range (free_map, free_map_file, start, cnt))
+        bitmap_reset (free_map_dirty, i);
+      else
+        success = false;
+    }
+  return success;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,12 +181,18 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  lock_acquire (&free_map_lock);
+  ASSERT (batch_depth == 0);
+  if (!persist ())
+    PANIC ("can't write free map");
+  lock_release (&free_map_lock);
   file_close (free_map_file);
 }
 
@@ -82,4 +211,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
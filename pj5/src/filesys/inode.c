@@ -13,14 +13,53 @@
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Identifies an extent-based inode. */
+#define INODE_EXTENT_MAGIC 0x494e4f45
+
+/* Number of extents in an extent-based inode, and in the extent
+   block that holds any more. */
+#define INODE_EXTENT_CNT 61
+#define INODE_EXTENT_BLOCK_CNT 64
+
+/* Most sectors allocated ahead of need when an extent-based
+   file grows. */
+#define INODE_EXTENT_PREALLOC 128
+
+/* If true, new inodes are extent-based.
+   Controlled by kernel command-line option "-extents" at format
+   time, and by the root file system's layout otherwise. */
+bool inode_extents;
+
+/* A run of LENGTH consecutive data sectors starting at START. */
+struct inode_extent
+  {
+    block_sector_t start;
+    uint32_t length;
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   MAGIC tells which of the two block layouts is in use. */
 struct inode_disk
   {
-    /** Data sectors */
-    block_sector_t direct_blocks[123];
-    block_sector_t indirect_block;
-    block_sector_t doubly_indirect_block;
+    union
+      {
+        /** Data sectors (INODE_MAGIC) */
+        struct
+          {
+            block_sector_t direct_blocks[123];
+            block_sector_t indirect_block;
+            block_sector_t doubly_indirect_block;
+          };
+
+        /** Data sector runs, in file order (INODE_EXTENT_MAGIC) */
+        struct
+          {
+            uint32_t extent_cnt;
+            struct inode_extent extents[INODE_EXTENT_CNT];
+            block_sector_t extent_block;    /* Extents past the above. */
+          };
+      };
 
     bool is_dir;
     off_t length;                       /* File size in bytes. */
@@ -31,7 +70,14 @@ struct inode_indirect_block_sector {
   block_sector_t blocks[128];
 };
 
+/* Extents INODE_EXTENT_CNT and up of an extent-based inode. */
+struct inode_extent_block {
+  struct inode_extent extents[INODE_EXTENT_BLOCK_CNT];
+};
+
 static bool inode_reserve (struct inode_disk *disk_inode, off_t length);
+static bool inode_reserve_extents (struct inode_disk *disk_inode,
+                                   off_t length);
 static bool inode_deallocate (struct inode *inode);
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -60,13 +106,115 @@ struct inode
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Read-ahead state, in sector indexes within the file. */
+    off_t ra_last;                      /* Last index read. */
+    off_t ra_window;                    /* Sectors to keep ahead, 0 if off. */
+    off_t ra_issued;                    /* Indexes below this are requested. */
+
+    /* In-memory copies of the indirect blocks, loaded on demand. */
+    struct lock map_lock;               /* Guards the copies below. */
+    struct inode_indirect_block_sector *map_indirect;
+    struct inode_indirect_block_sector *map_doubly;
+    struct inode_indirect_block_sector **map_doubly_leaves; /* 128 slots. */
+    struct inode_extent_block *map_extents;
   };
 
+/* Maps sector INDEX of an extent-based inode to a disk sector.
+   Only an index past the extents in the inode itself needs the
+   extent block, which is kept in memory once read. */
+static block_sector_t
+extent_index_to_sector (struct inode *inode, off_t index)
+{
+  const struct inode_disk *idisk = &inode->data;
+  block_sector_t ret = -1;
+  uint32_t i;
+
+  for (i = 0; i < idisk->extent_cnt && i < INODE_EXTENT_CNT; ++ i) {
+    if ((uint32_t) index < idisk->extents[i].length)
+      return idisk->extents[i].start + index;
+    index -= idisk->extents[i].length;
+  }
+  if (idisk->extent_cnt <= INODE_EXTENT_CNT)
+    return -1;
+
+  lock_acquire (&inode->map_lock);
+  if (inode->map_extents == NULL) {
+    inode->map_extents = malloc (sizeof *inode->map_extents);
+    if (inode->map_extents != NULL)
+      buffer_cache_read (idisk->extent_block, inode->map_extents);
+  }
+  if (inode->map_extents != NULL)
+    for (i = 0; i < idisk->extent_cnt - INODE_EXTENT_CNT; ++ i) {
+      const struct inode_extent *e = &inode->map_extents->extents[i];
+      if ((uint32_t) index < e->length) {
+        ret = e->start + index;
+        break;
+      }
+      index -= e->length;
+    }
+  lock_release (&inode->map_lock);
+  return ret;
+}
+
+/* Returns extent I of DISK_INODE, where MORE holds the contents of
+   its extent block. */
+static struct inode_extent *
+extent_at (struct inode_disk *disk_inode, struct inode_extent_block *more,
+           uint32_t i)
+{
+  if (i < INODE_EXTENT_CNT)
+    return &disk_inode->extents[i];
+  return &more->extents[i - INODE_EXTENT_CNT];
+}
+
+/* Returns the in-memory copy of indirect block SECTOR kept in
+   *CACHED, reading it in first if necessary.
+   Returns a null pointer if memory allocation fails. */
+static struct inode_indirect_block_sector *
+inode_map_load (struct inode_indirect_block_sector **cached,
+                block_sector_t sector)
+{
+  if (*cached == NULL) {
+    *cached = malloc (sizeof **cached);
+    if (*cached != NULL)
+      buffer_cache_read (sector, *cached);
+  }
+  return *cached;
+}
+
+/* Drops INODE's in-memory copies of its indirect blocks.  They
+   are loaded again on demand. */
+static void
+inode_map_invalidate (struct inode *inode)
+{
+  size_t i;
+
+  lock_acquire (&inode->map_lock);
+  free (inode->map_indirect);
+  free (inode->map_doubly);
+  if (inode->map_doubly_leaves != NULL) {
+    for (i = 0; i < 128; ++ i)
+      free (inode->map_doubly_leaves[i]);
+    free (inode->map_doubly_leaves);
+  }
+  free (inode->map_extents);
+  inode->map_indirect = NULL;
+  inode->map_extents = NULL;
+  inode->map_doubly = NULL;
+  inode->map_doubly_leaves = NULL;
+  lock_release (&inode->map_lock);
+}
+
 static block_sector_t
-index_to_sector (const struct inode_disk *idisk, off_t index)
+index_to_sector (struct inode *inode, off_t index)
 {
+  const struct inode_disk *idisk = &inode->data;
   off_t index_base = 0, index_limit = 0;   // base, limit for sector index
-  block_sector_t ret;
+  block_sector_t ret = -1;
+
+  if (idisk->magic == INODE_EXTENT_MAGIC)
+    return extent_index_to_sector (inode, index);
 
   // (1) direct blocks
   index_limit += 123 * 1;
@@ -79,12 +227,13 @@ index_to_sector (const struct inode_disk *idisk, off_t index)
   index_limit += 1 * 128;
   if (index < index_limit) {
     struct inode_indirect_block_sector *indirect_idisk;
-    indirect_idisk = calloc(1, sizeof(struct inode_indirect_block_sector));
-    buffer_cache_read (idisk->indirect_block, indirect_idisk);
 
-    just_in_case();
-    ret = indirect_idisk->blocks[ index - index_base ];
-    free(indirect_idisk);
+    lock_acquire (&inode->map_lock);
+    indirect_idisk = inode_map_load (&inode->map_indirect,
+                                     idisk->indirect_block);
+    if (indirect_idisk != NULL)
+      ret = indirect_idisk->blocks[ index - index_base ];
+    lock_release (&inode->map_lock);
 
     return ret;
   }
@@ -97,16 +246,22 @@ index_to_sector (const struct inode_disk *idisk, off_t index)
     off_t index_first =  (index - index_base) / 128;
     off_t index_second = (index - index_base) % 128;
 
-    // fetch two indirect block sectors
+    // fetch two indirect block sectors, unless already in memory
     struct inode_indirect_block_sector *indirect_idisk;
-    indirect_idisk = calloc(1, sizeof(struct inode_indirect_block_sector));
 
-    just_in_case();
-    buffer_cache_read (idisk->doubly_indirect_block, indirect_idisk);
-    buffer_cache_read (indirect_idisk->blocks[index_first], indirect_idisk);
-    ret = indirect_idisk->blocks[index_second];
+    lock_acquire (&inode->map_lock);
+    indirect_idisk = inode_map_load (&inode->map_doubly,
+                                     idisk->doubly_indirect_block);
+    if (indirect_idisk != NULL && inode->map_doubly_leaves == NULL)
+      inode->map_doubly_leaves = calloc (128, sizeof *inode->map_doubly_leaves);
+    if (indirect_idisk != NULL && inode->map_doubly_leaves != NULL) {
+      indirect_idisk = inode_map_load (&inode->map_doubly_leaves[index_first],
+                                       indirect_idisk->blocks[index_first]);
+      if (indirect_idisk != NULL)
+        ret = indirect_idisk->blocks[index_second];
+    }
+    lock_release (&inode->map_lock);
 
-    free(indirect_idisk);
     return ret;
   }
 
@@ -119,7 +274,7 @@ index_to_sector (const struct inode_disk *idisk, off_t index)
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if(0 > pos)
@@ -127,7 +282,7 @@ byte_to_sector (const struct inode *inode, off_t pos)
   else if (pos < inode->data.length) {
     // sector index
     off_t index = pos / BLOCK_SECTOR_SIZE;
-    return index_to_sector (&inode->data, index);
+    return index_to_sector (inode, index);
   }
   else
     return -1;
@@ -164,20 +319,35 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
+      disk_inode->magic = inode_extents ? INODE_EXTENT_MAGIC : INODE_MAGIC;
       disk_inode->is_dir = is_dir;
       just_in_case();
-      if (inode_reserve (disk_inode, disk_inode->length))
-        {
-          buffer_cache_write (sector, disk_inode);
-          success = true;
-        }
+      free_map_begin_batch ();
+      // grow from empty, so that the whole length is zeroed
+      success = inode_reserve (disk_inode, length);
+      free_map_end_batch ();
+      disk_inode->length = length;
+      if (success)
+        buffer_cache_write (sector, disk_inode);
       free (disk_inode);
     }
   return success;
 }
 
+/* Makes new inodes use the same layout as the inode in SECTOR,
+   i.e. the layout the file system was formatted with. */
+void
+inode_adopt_layout (block_sector_t sector)
+{
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+  if (disk_inode == NULL)
+    PANIC ("can't read inode layout");
+
+  buffer_cache_read (sector, disk_inode);
+  inode_extents = disk_inode->magic == INODE_EXTENT_MAGIC;
+  free (disk_inode);
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
@@ -210,6 +380,14 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->ra_last = -1;
+  inode->ra_window = 0;
+  inode->ra_issued = 0;
+  lock_init (&inode->map_lock);
+  inode->map_indirect = NULL;
+  inode->map_extents = NULL;
+  inode->map_doubly = NULL;
+  inode->map_doubly_leaves = NULL;
 
   just_in_case();
   buffer_cache_read (inode->sector, &inode->data);
@@ -251,11 +429,14 @@ inode_close (struct inode *inode)
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          free_map_begin_batch ();
           free_map_release (inode->sector, 1);
           just_in_case();
           inode_deallocate (inode);
+          free_map_end_batch ();
         }
 
+      inode_map_invalidate (inode);
       free (inode);
     }
 }
@@ -269,6 +450,51 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Detects sequential reads of INODE and keeps the buffer cache
+   loaded ahead of them.  Like Linux's readahead, the window
+   starts small, doubles on every sequential read up to
+   READ_AHEAD_MAX sectors and collapses on a random access. */
+static void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t length = inode_length (inode);
+  off_t first, last, start, end, limit;
+
+  if (size <= 0 || offset < 0 || offset >= length)
+    return;
+  first = offset / BLOCK_SECTOR_SIZE;
+  last = (min (offset + size, length) - 1) / BLOCK_SECTOR_SIZE;
+
+  if (first == inode->ra_last || first == inode->ra_last + 1) {
+    // sequential: grow the window, bounded by the cache size
+    limit = min (READ_AHEAD_MAX, buffer_cache_size / 4);
+    inode->ra_window = min (inode->ra_window == 0 ? READ_AHEAD_MIN
+                                                  : inode->ra_window * 2,
+                            limit);
+  }
+  else {
+    inode->ra_window = 0;
+    inode->ra_issued = 0;
+  }
+  inode->ra_last = last;
+  if (inode->ra_window == 0)
+    return;
+
+  // request what is not already in flight
+  start = last + 1 > inode->ra_issued ? last + 1 : inode->ra_issued;
+  end = min (last + inode->ra_window, bytes_to_sectors (length) - 1);
+  for (; start <= end; start++) {
+    block_sector_t sector = index_to_sector (inode, start);
+
+    // the map couldn't be loaded: try again on a later read
+    if (sector == (block_sector_t) -1)
+      break;
+    buffer_cache_prefetch (sector);
+  }
+  if (start > inode->ra_issued)
+    inode->ra_issued = start;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -279,6 +505,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
 
+  inode_read_ahead (inode, size, offset);
+
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -345,7 +573,11 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   if( byte_to_sector(inode, offset + size - 1) == -1u ) {
     // extend and reserve up to [offset + size] bytes
     bool success;
+    free_map_begin_batch ();
     success = inode_reserve (& inode->data, offset + size);
+    free_map_end_batch ();
+    // the indirect blocks may have gained entries
+    inode_map_invalidate (inode);
     if (!success) return 0;  // fail?
 
     // write back the (extended) file size
@@ -496,6 +728,8 @@ inode_reserve (struct inode_disk *disk_inode, off_t length)
 {
   static char zeros[BLOCK_SECTOR_SIZE];
   if (length < 0) return false;
+  if (disk_inode->magic == INODE_EXTENT_MAGIC)
+    return inode_reserve_extents (disk_inode, length);
 
   // (remaining) number of sectors, occupied by this file.
   size_t num_sectors = bytes_to_sectors(length);
@@ -531,6 +765,106 @@ inode_reserve (struct inode_disk *disk_inode, off_t length)
   return false;
 }
 
+/**
+ * Extend an extent-based inode, so that the file can hold at
+ * least `length` bytes.  A file grows like a vector: each new run
+ * asks for as many sectors as the file already has (up to
+ * INODE_EXTENT_PREALLOC), right after its last run if possible,
+ * falling back to smaller runs when the disk is fragmented.
+ * Extents that don't fit in the inode go into its extent block.
+ *
+ * Only the sectors between the old and the new length are zeroed.
+ * Sectors allocated ahead of need are zeroed when a later call
+ * brings them inside the file, so preallocation doesn't flush
+ * the buffer cache with zeros nobody reads.
+ */
+static bool
+inode_reserve_extents (struct inode_disk *disk_inode, off_t length)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  struct inode_extent_block more;
+  size_t allocated = 0, needed = bytes_to_sectors (length);
+  size_t covered = bytes_to_sectors (disk_inode->length);
+  size_t index, j;
+  bool more_changed = false, success = true;
+  uint32_t i;
+
+  if (disk_inode->extent_cnt > INODE_EXTENT_CNT)
+    buffer_cache_read (disk_inode->extent_block, &more);
+  for (i = 0; i < disk_inode->extent_cnt; ++ i)
+    allocated += extent_at (disk_inode, &more, i)->length;
+
+  while (success && allocated < needed) {
+    struct inode_extent *last = NULL;
+    size_t want = needed - allocated;
+    size_t cnt = min (allocated, INODE_EXTENT_PREALLOC);
+    block_sector_t start = 0;
+    uint32_t n = disk_inode->extent_cnt;
+
+    if (n > 0)
+      last = extent_at (disk_inode, &more, n - 1);
+    if (cnt < want)
+      cnt = want;
+
+    success = false;
+    while (!success && cnt > 0) {
+      if (last != NULL
+          && free_map_allocate_at (last->start + last->length, cnt)) {
+        start = last->start + last->length;
+        success = true;
+      }
+      else if (free_map_allocate (cnt, &start))
+        success = true;
+      else
+        cnt = cnt > want ? want : cnt / 2;
+    }
+    if (!success)
+      break;
+
+    if (last != NULL && start == last->start + last->length) {
+      last->length += cnt;
+      more_changed |= n > INODE_EXTENT_CNT;
+    }
+    else if (n < INODE_EXTENT_CNT + INODE_EXTENT_BLOCK_CNT) {
+      if (n == INODE_EXTENT_CNT) {
+        // first extent that doesn't fit in the inode
+        if (!free_map_allocate (1, &disk_inode->extent_block)) {
+          free_map_release (start, cnt);
+          success = false;
+          break;
+        }
+        memset (&more, 0, sizeof more);
+      }
+      extent_at (disk_inode, &more, n)->start = start;
+      extent_at (disk_inode, &more, n)->length = cnt;
+      disk_inode->extent_cnt++;
+      more_changed |= n >= INODE_EXTENT_CNT;
+    }
+    else {
+      // out of extents: the file is too fragmented to grow
+      free_map_release (start, cnt);
+      success = false;
+      break;
+    }
+    allocated += cnt;
+  }
+  if (more_changed)
+    buffer_cache_write (disk_inode->extent_block, &more);
+  if (!success)
+    return false;
+
+  // zero what is newly inside the file
+  index = 0;
+  for (i = 0; i < disk_inode->extent_cnt && index < needed; ++ i) {
+    struct inode_extent *e = extent_at (disk_inode, &more, i);
+    for (j = index > covered ? index : covered;
+         j < index + e->length && j < needed; ++ j)
+      buffer_cache_write (e->start + (j - index), zeros);
+    index += e->length;
+  }
+  return true;
+}
+
 static void
 inode_deallocate_indirect (block_sector_t entry, size_t num_sectors, int level)
 {
@@ -562,6 +896,20 @@ bool inode_deallocate (struct inode *inode)
   off_t file_length = inode->data.length; // bytes
   if(file_length < 0) return false;
 
+  if (inode->data.magic == INODE_EXTENT_MAGIC) {
+    struct inode_extent_block more;
+    uint32_t e;
+
+    if (inode->data.extent_cnt > INODE_EXTENT_CNT)
+      buffer_cache_read (inode->data.extent_block, &more);
+    for (e = 0; e < inode->data.extent_cnt; ++ e)
+      free_map_release (extent_at (&inode->data, &more, e)->start,
+                        extent_at (&inode->data, &more, e)->length);
+    if (inode->data.extent_cnt > INODE_EXTENT_CNT)
+      free_map_release (inode->data.extent_block, 1);
+    return true;
+  }
+
   // (remaining) number of sectors, occupied by this file.
   size_t num_sectors = bytes_to_sectors(file_length);
   size_t i, l;
@@ -7,7 +7,11 @@
 
 struct bitmap;
 
+/* If true, new inodes are extent-based. */
+extern bool inode_extents;
+
 void inode_init (void);
+void inode_adopt_layout (block_sector_t);
 bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
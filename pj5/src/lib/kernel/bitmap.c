@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -28,6 +29,9 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Summary, one bit per element of BITS, set
+                           when that element has no false bits.
+                           May be null, if it could not be allocated. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -69,6 +73,28 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a bit mask in which the bits actually used in element
+   IDX of B's bits are set to 1. */
+static inline elem_type
+used_mask (const struct bitmap *b, size_t idx)
+{
+  return idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+}
+
+/* Brings the summary bit for element IDX of B's bits up to date. */
+static inline void
+update_full (struct bitmap *b, size_t idx)
+{
+  if (b->full != NULL)
+    {
+      elem_type used = used_mask (b, idx);
+      if ((b->bits[idx] & used) == used)
+        b->full[elem_idx (idx)] |= bit_mask (idx);
+      else
+        b->full[elem_idx (idx)] &= ~bit_mask (idx);
+    }
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -85,6 +111,9 @@ bitmap_create (size_t bit_cnt)
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
+          /* The summary only speeds up scans, so do without it
+             if there is no memory for it. */
+          b->full = malloc (byte_cnt (elem_cnt (bit_cnt)));
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +134,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = b->bits + elem_cnt (bit_cnt);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +144,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return (sizeof (struct bitmap) + byte_cnt (bit_cnt)
+          + byte_cnt (elem_cnt (bit_cnt)));
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -125,6 +156,7 @@ bitmap_destroy (struct bitmap *b)
   if (b != NULL) 
     {
       free (b->bits);
+      free (b->full);
       free (b);
     }
 }
@@ -158,11 +190,14 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  enum intr_level old_level;
+
+  /* The summary bit has to change together with the bit itself,
+     or a racing update could leave it claiming a full element. */
+  old_level = intr_disable ();
+  b->bits[idx] |= mask;
+  update_full (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -171,11 +206,13 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level;
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  /* See bitmap_mark(). */
+  old_level = intr_disable ();
+  b->bits[idx] &= ~mask;
+  update_full (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -186,11 +223,13 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level;
 
-  /* This is equivalent to `b->bits[idx] ^= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  /* See bitmap_mark(). */
+  old_level = intr_disable ();
+  b->bits[idx] ^= mask;
+  update_full (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +252,56 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Returns a mask selecting the bits of the element containing
+   bit START that lie in [START, START + CNT), and stores the
+   number of those bits in *N. */
+static inline elem_type
+range_mask (size_t start, size_t cnt, size_t *n)
+{
+  size_t ofs = start % ELEM_BITS;
+
+  *n = ELEM_BITS - ofs < cnt ? ELEM_BITS - ofs : cnt;
+  if (*n == ELEM_BITS)
+    return (elem_type) -1;
+  return (((elem_type) 1 << *n) - 1) << ofs;
+}
+
+/* Returns the number of 1-bits in X.  GCC's popcount builtin
+   turns into a call into libgcc, which the kernel does not link. */
+static inline size_t
+popcount (elem_type x)
+{
+  size_t cnt;
+
+  for (cnt = 0; x != 0; cnt++)
+    x &= x - 1;
+  return cnt;
+}
+
+/* Sets the CNT bits starting at START in B to VALUE.
+   Whole elements are written at once, so unlike bitmap_set()
+   this is not atomic. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t n;
+      elem_type mask = range_mask (start, cnt, &n);
+
+      if (value)
+        b->bits[idx] |= mask;
+      else
+        b->bits[idx] &= ~mask;
+      update_full (b, idx);
+      start += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +309,76 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t left, true_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  true_cnt = 0;
+  for (left = cnt; left > 0; )
+    {
+      size_t n;
+      elem_type mask = range_mask (start, left, &n);
+
+      true_cnt += popcount (b->bits[elem_idx (start)] & mask);
+      start += n;
+      left -= n;
+    }
+  return value ? true_cnt : cnt - true_cnt;
+}
+
+/* Returns the index of the first element of B's bits at or after
+   IDX whose summary bit is clear, that is, that has at least one
+   false bit, or the number of elements if there is none. */
+static size_t
+next_nonfull (const struct bitmap *b, size_t idx)
+{
+  size_t elems = elem_cnt (b->bit_cnt);
+  size_t sum = elem_idx (idx);
+  elem_type word;
+
+  if (idx >= elems)
+    return elems;
+  word = ~b->full[sum] & ((elem_type) -1 << (idx % ELEM_BITS));
+  while (word == 0)
+    {
+      if (++sum >= elem_cnt (elems))
+        return elems;
+      word = ~b->full[sum];
+    }
+  idx = sum * ELEM_BITS + __builtin_ctzl (word);
+  return idx < elems ? idx : elems;
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none.
+   Skips whole elements that hold no such bit, and when looking
+   for false bits, uses the summary to skip runs of full ones. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value)
+{
+  size_t elems = elem_cnt (b->bit_cnt);
+  size_t idx = elem_idx (start);
+  elem_type word;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+  word = (value ? b->bits[idx] : ~b->bits[idx])
+         & ((elem_type) -1 << (start % ELEM_BITS));
+  while (word == 0)
+    {
+      idx++;
+      if (!value && b->full != NULL)
+        idx = next_nonfull (b, idx);
+      if (idx >= elems)
+        return b->bit_cnt;
+      word = value ? b->bits[idx] : ~b->bits[idx];
+    }
+
+  /* Unused bits past the end are false, so clamp. */
+  start = idx * ELEM_BITS + __builtin_ctzl (word);
+  return start < b->bit_cnt ? start : b->bit_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +386,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && next_bit (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -301,10 +432,25 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return i <= last ? i : BITMAP_ERROR;
+
+      /* Jump from the start of each run of VALUE bits to the end
+         of it, rather than testing every starting bit. */
+      while (i <= last)
+        {
+          size_t end;
+
+          i = next_bit (b, i, value);
+          if (i > last)
+            break;
+          end = next_bit (b, i, !value);
+          if (end - i >= cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -314,8 +460,8 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
    and returns the index of the first bit in the group.
    If there is no such group, returns BITMAP_ERROR.
    If CNT is zero, returns 0.
-   Bits are set atomically, but testing bits is not atomic with
-   setting them. */
+   Neither testing nor setting the bits is atomic, so callers
+   must serialize access to B. */
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
@@ -344,8 +490,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        update_full (b, i);
     }
   return success;
 }
@@ -358,6 +508,28 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to the same position in FILE, rounded out to whole bytes.
+   Relies on the little-endian layout of elem_type, which puts
+   bit K in byte K / CHAR_BIT.  Returns true if successful, false
+   otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  ofs = start / CHAR_BIT;
+  size = (start + cnt - 1) / CHAR_BIT + 1 - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,7 @@
+/* Creates a directory,
+   then creates 400 files in that directory, enough for it to be
+   looked up through a name index. */
+
+#define FILE_CNT 400
+#define DIRECTORY "/x"
+#include "tests/filesys/extended/grow-dir.inc"
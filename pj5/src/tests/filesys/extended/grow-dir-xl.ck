@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($expected) = "(grow-dir-xl) begin\n(grow-dir-xl) mkdir /x\n";
+$expected .= "(grow-dir-xl) creating and checking \"/x/file$_\"\n"
+  foreach 0...399;
+$expected .= "(grow-dir-xl) end\n";
+check_expected (IGNORE_EXIT_CODES => 1, [$expected]);
+pass;
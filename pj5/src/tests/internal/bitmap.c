@@ -0,0 +1,160 @@
+/* Test program and micro-benchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count() and bitmap_contains()
+   against straightforward bit-by-bit versions on random bitmaps,
+   then times first-fit searches with both, the way
+   palloc_get_multiple() and free_map_allocate() use them.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Largest bitmap that we will test, in bits. */
+#define MAX_BITS 4096
+
+/* Size of the bitmap used for timing, in bits, and the number of
+   searches timed. */
+#define BENCH_BITS 65536
+#define BENCH_ITERS 200
+
+static void fill_random (struct bitmap *, int density);
+static size_t naive_scan (const struct bitmap *, size_t start, size_t cnt,
+                          bool);
+static size_t naive_count (const struct bitmap *, size_t start, size_t cnt,
+                           bool);
+static void benchmark (void);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  size_t size;
+
+  printf ("testing various size bitmaps:");
+  for (size = 0; size <= MAX_BITS; size = size * 2 + 1)
+    {
+      int repeat;
+
+      printf (" %zu", size);
+      for (repeat = 0; repeat < 10; repeat++)
+        {
+          struct bitmap *b = bitmap_create (size);
+          int i;
+
+          ASSERT (b != NULL);
+          fill_random (b, random_ulong () % 101);
+          for (i = 0; i < 64; i++)
+            {
+              size_t start = random_ulong () % (size + 1);
+              size_t cnt = random_ulong () % 48;
+              size_t span = random_ulong () % (size - start + 1);
+              bool value = random_ulong () % 2;
+
+              ASSERT (bitmap_scan (b, start, cnt, value)
+                      == naive_scan (b, start, cnt, value));
+              ASSERT (bitmap_count (b, start, span, value)
+                      == naive_count (b, start, span, value));
+              ASSERT (bitmap_contains (b, start, span, value)
+                      == (naive_count (b, start, span, value) > 0));
+
+              /* Change a random range so the summary is exercised
+                 after updates as well as after creation. */
+              if (size > 0)
+                {
+                  size_t ofs = random_ulong () % size;
+                  bitmap_set_multiple (b, ofs,
+                                       random_ulong () % (size - ofs + 1),
+                                       random_ulong () % 2);
+                }
+            }
+          bitmap_destroy (b);
+        }
+    }
+  printf (" done\n");
+
+  benchmark ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Times first-fit searches for free runs in a mostly full bitmap,
+   with bitmap_scan() and with naive_scan(). */
+static void
+benchmark (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  size_t expect;
+  int i;
+
+  ASSERT (b != NULL);
+  fill_random (b, 98);
+  bitmap_set_multiple (b, BENCH_BITS - 64, 64, false);
+  expect = naive_scan (b, 0, 8, false);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ITERS; i++)
+    ASSERT (bitmap_scan (b, 0, 8, false) == expect);
+  printf ("bitmap_scan: %"PRId64" ticks for %d scans\n",
+          timer_elapsed (start), BENCH_ITERS);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ITERS; i++)
+    ASSERT (naive_scan (b, 0, 8, false) == expect);
+  printf ("naive scan: %"PRId64" ticks for %d scans\n",
+          timer_elapsed (start), BENCH_ITERS);
+
+  bitmap_destroy (b);
+}
+
+/* Sets each bit in B to true with probability DENSITY percent. */
+static void
+fill_random (struct bitmap *b, int density)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < density);
+}
+
+/* bitmap_scan() as it was before it learned to skip whole
+   elements: tries every starting bit in turn. */
+static size_t
+naive_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i, j;
+      for (i = start; i <= last; i++)
+        {
+          for (j = 0; j < cnt; j++)
+            if (bitmap_test (b, i + j) != value)
+              break;
+          if (j == cnt)
+            return i;
+        }
+    }
+  return BITMAP_ERROR;
+}
+
+/* Counts the bits in B between START and START + CNT, exclusive,
+   that are set to VALUE, one bit at a time. */
+static size_t
+naive_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt;
+
+  value_cnt = 0;
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
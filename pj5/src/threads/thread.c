@@ -156,6 +156,25 @@ thread_tick ()
    removing from the wait queue and pushing it into the ready queue.
 
    This function must be called with interrupts turned off. */
+void
+thread_awake (int64_t current_tick)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&wait_list); e != list_end (&wait_list); )
+    {
+      struct thread *t = list_entry (e, struct thread, waitelem);
+      if (current_tick >= t->sleep_endtick)
+        {
+          e = list_remove (e);
+          thread_unblock (t);
+        }
+      else
+        e = list_next (e);
+    }
+}
 
 /* Prints thread statistics. */
 void
@@ -290,8 +309,14 @@ thread_unblock (struct thread *t)
   t->status = THREAD_READY;
 
   // ensure preemption : compare priorities of current thread and t (to be unblocked),
+  // (from the timer interrupt, via thread_awake, yield on return instead)
   if (thread_current() != idle_thread && thread_current()->priority < t->priority )
-    thread_yield();
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
 
   intr_set_level (old_level);
 }
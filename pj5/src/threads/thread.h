@@ -146,6 +146,7 @@ void thread_block (void);
 void thread_unblock (struct thread *);
 
 void thread_sleep_until (int64_t wake_tick);
+void thread_awake (int64_t current_tick);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);